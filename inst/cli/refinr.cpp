@@ -0,0 +1,607 @@
+// refinr command-line driver.
+//
+// Clusters and merges the values of a newline-delimited file that is too
+// large to load into an R session, using the key collision or ngram method
+// with the same options as key_collision_merge() and n_gram_merge(). The
+// input file is memory mapped and read in two streaming passes: the first
+// counts the distinct values and builds the key index, the second rewrites
+// each line as its canonical value (or cluster id). Memory use grows with
+// the number of distinct values and keys, not with the size of the file,
+// values are held as views into the mapped file.
+//
+// Build from the package root with a C++17 compiler, e.g.
+//
+//   c++ -std=c++17 -O2 -I inst/include -o refinr inst/cli/refinr.cpp
+//
+// Differences from the R functions: accents are not transliterated, and only
+// ASCII chars are lower cased, so input is expected to be ASCII (or already
+// transliterated). Trailing carriage returns are dropped from each line.
+//
+// Ctrl-C (SIGINT) cancels the run at the next progress check, and removes
+// the partial output file.
+//
+// Requires a POSIX system (mmap).
+
+#include <refinr/core.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* usage =
+  "usage: refinr [options] <input> <output>\n"
+  "\n"
+  "Cluster and merge the values of <input>, one value per line, and write\n"
+  "the result to <output>, one line per input line.\n"
+  "\n"
+  "options:\n"
+  "  -m, --method kc|ngram     clustering method (default kc)\n"
+  "  -n, --numgram N           ngram size, for method ngram (default 2)\n"
+  "  -e, --edit-threshold X    max edit distance for approximate ngram\n"
+  "                            matching, 0 to disable (default 1)\n"
+  "  -w, --weight D,I,S,T      edit costs of deletion, insertion,\n"
+  "                            substitution and transposition\n"
+  "                            (default 0.33,0.33,1,0.5)\n"
+  "  -d, --distance lv|osa     edit distance (default lv)\n"
+  "  -b, --blocking unigram|minhash|sorted\n"
+  "                            how values are blocked before approximate\n"
+  "                            matching (default unigram)\n"
+  "      --bands N             minhash bands (default 20)\n"
+  "      --rows N              minhash rows per band (default 5)\n"
+  "      --window N            keys compared with each key per sort order,\n"
+  "                            for sorted blocking (default 10)\n"
+  "  -t, --threads N           threads for minhash signatures (default 1)\n"
+  "  -i, --ignore STRING       string to ignore during clustering, may be\n"
+  "                            repeated\n"
+  "      --no-bus-suffix       don't merge business name suffixes\n"
+  "      --dict FILE           reference values, one per line, for method kc\n"
+  "  -o, --output values|ids   write canonical values, or 1-based cluster ids\n"
+  "                            (default values)\n"
+  "  -p, --progress            report the progress of each stage on stderr\n"
+  "  -h, --help                show this message\n";
+
+static void fail(const std::string &msg) {
+  fprintf(stderr, "refinr: %s\n", msg.c_str());
+  exit(1);
+}
+
+
+// Read only memory mapping of a whole file.
+class mapped_file {
+public:
+  explicit mapped_file(const char* path) : data(NULL), size(0) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+      fail(std::string("can't open ") + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+      fail(std::string("can't stat ") + path + ": " + strerror(errno));
+    }
+    size = st.st_size;
+    if(size > 0) {
+      void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(p == MAP_FAILED) {
+        fail(std::string("can't map ") + path + ": " + strerror(errno));
+      }
+      madvise(p, size, MADV_SEQUENTIAL);
+      data = static_cast<const char*>(p);
+    }
+    close(fd);
+  }
+
+  ~mapped_file() {
+    if(data != NULL) {
+      munmap(const_cast<char*>(data), size);
+    }
+  }
+
+  size_t size_bytes() const { return size; }
+
+  // Call fn on each line of the file, without the line terminator.
+  template <class LineFn>
+  void for_each_line(LineFn fn) const {
+    const char* p = data;
+    const char* end = data + size;
+    while(p < end) {
+      const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+      const char* line_end = nl == NULL ? end : nl;
+      size_t len = line_end - p;
+      if(len > 0 && p[len - 1] == '\r') {
+        len--;
+      }
+      fn(std::string_view(p, len));
+      p = line_end + 1;
+    }
+  }
+
+private:
+  const char* data;
+  size_t size;
+};
+
+
+// Buffered writer of output lines.
+class line_writer {
+public:
+  explicit line_writer(const char* path) : path(path) {
+    f = fopen(path, "wb");
+    if(f == NULL) {
+      fail(std::string("can't open ") + path + ": " + strerror(errno));
+    }
+    buf.reserve(1 << 20);
+  }
+
+  void write(std::string_view line) {
+    if(buf.size() + line.size() + 1 > buf.capacity()) {
+      flush();
+    }
+    buf.append(line);
+    buf += '\n';
+  }
+
+  void close() {
+    flush();
+    if(fclose(f) != 0) {
+      fail(std::string("can't write ") + path + ": " + strerror(errno));
+    }
+  }
+
+private:
+  const char* path;
+  FILE* f;
+  std::string buf;
+
+  void flush() {
+    if(!buf.empty() && fwrite(buf.data(), 1, buf.size(), f) != buf.size()) {
+      fail(std::string("can't write ") + path + ": " + strerror(errno));
+    }
+    buf.clear();
+  }
+};
+
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int) {
+  interrupted = 1;
+}
+
+// Progress of the run. Cancels the run on SIGINT, and if show is true,
+// draws one line per stage on stderr, at most every 200 ms.
+class cli_progress : public refinr::progress {
+public:
+  explicit cli_progress(bool show) : show(show) {}
+
+  // End the line of the current stage.
+  void finish() {
+    if(show && !curr_stage.empty()) {
+      fputc('\n', stderr);
+    }
+    curr_stage.clear();
+  }
+
+protected:
+  void update(const char* name, double done, double total) {
+    if(interrupted) {
+      throw refinr::cancelled();
+    }
+    if(!show) {
+      return;
+    }
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    bool ends = done >= total && last_done < total;
+    if(curr_stage != name) {
+      if(!curr_stage.empty()) {
+        fputc('\n', stderr);
+      }
+      curr_stage = name;
+      stage_start = now;
+    } else if(!ends && now - last_update < std::chrono::milliseconds(200)) {
+      return;
+    }
+    last_update = now;
+    last_done = done;
+    double secs = std::chrono::duration<double>(now - stage_start).count();
+    char line[128];
+    snprintf(line, sizeof(line), "%-11s %5.1f%% %.0f/%.0f, %.0f/s", name,
+             total > 0 ? 100 * std::min(done / total, 1.0) : 100.0, done,
+             total, secs > 0 ? done / secs : 0.0);
+    fprintf(stderr, "\r%-72s", line);
+  }
+
+private:
+  bool show;
+  std::string curr_stage;
+  std::chrono::steady_clock::time_point stage_start;
+  std::chrono::steady_clock::time_point last_update;
+  double last_done = 0;
+};
+
+
+struct sv_hash {
+  size_t operator()(std::string_view x) const {
+    return std::hash<std::string_view>()(x);
+  }
+};
+
+typedef refinr::key_index<std::string_view, sv_hash> sv_index;
+
+// Interned strings, numbered in order of first insertion. The strings are
+// kept in an arena (see refinr/arena.h), so views of them stay valid as more
+// are added.
+class string_pool {
+public:
+  string_pool() : index(1024) {}
+
+  int insert(const std::string &x) {
+    int id = index.find(x);
+    if(id >= 0) {
+      return id;
+    }
+    return index.insert(store[store.push(x)]);
+  }
+
+  std::string_view operator[](int id) const { return store[id]; }
+  int size() const { return index.size(); }
+
+private:
+  refinr::string_arena store;
+  sv_index index;
+};
+
+
+struct options {
+  std::string method = "kc";
+  int numgram = 2;
+  double edit_threshold = 1;
+  double weight[4] = {0.33, 0.33, 1, 0.5};
+  std::string distance = "lv";
+  std::string blocking = "unigram";
+  int bands = 20;
+  int rows = 5;
+  int window = 10;
+  int threads = 1;
+  std::vector<std::string> ignore_strings;
+  bool bus_suffix = true;
+  const char* dict = NULL;
+  std::string output = "values";
+  bool progress = false;
+  const char* input_path = NULL;
+  const char* output_path = NULL;
+};
+
+static options parse_args(int argc, char** argv) {
+  options opts;
+  std::vector<const char*> paths;
+
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&]() -> const char* {
+      if(i + 1 >= argc) {
+        fail("missing value for " + arg);
+      }
+      return argv[++i];
+    };
+    if(arg == "-h" || arg == "--help") {
+      fputs(usage, stdout);
+      exit(0);
+    } else if(arg == "-m" || arg == "--method") {
+      opts.method = next();
+    } else if(arg == "-n" || arg == "--numgram") {
+      opts.numgram = atoi(next());
+    } else if(arg == "-e" || arg == "--edit-threshold") {
+      opts.edit_threshold = atof(next());
+    } else if(arg == "-w" || arg == "--weight") {
+      const char* w = next();
+      if(sscanf(w, "%lf,%lf,%lf,%lf", &opts.weight[0], &opts.weight[1],
+                &opts.weight[2], &opts.weight[3]) != 4) {
+        fail("--weight must be four comma separated numbers");
+      }
+    } else if(arg == "-d" || arg == "--distance") {
+      opts.distance = next();
+    } else if(arg == "-b" || arg == "--blocking") {
+      opts.blocking = next();
+    } else if(arg == "--bands") {
+      opts.bands = atoi(next());
+    } else if(arg == "--rows") {
+      opts.rows = atoi(next());
+    } else if(arg == "--window") {
+      opts.window = atoi(next());
+    } else if(arg == "-t" || arg == "--threads") {
+      opts.threads = atoi(next());
+    } else if(arg == "-i" || arg == "--ignore") {
+      std::string s = next();
+      for(char &c : s) {
+        c = refinr::to_lower_ascii(c);
+      }
+      opts.ignore_strings.push_back(s);
+    } else if(arg == "--no-bus-suffix") {
+      opts.bus_suffix = false;
+    } else if(arg == "--dict") {
+      opts.dict = next();
+    } else if(arg == "-o" || arg == "--output") {
+      opts.output = next();
+    } else if(arg == "-p" || arg == "--progress") {
+      opts.progress = true;
+    } else if(arg.size() > 1 && arg[0] == '-') {
+      fail("unknown option " + arg + "\n\n" + usage);
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+
+  if(paths.size() != 2) {
+    fail(std::string("expected an input and an output file\n\n") + usage);
+  }
+  opts.input_path = paths[0];
+  opts.output_path = paths[1];
+  if(opts.method != "kc" && opts.method != "ngram") {
+    fail("--method must be one of kc, ngram");
+  }
+  if(opts.numgram < 1) {
+    fail("--numgram must be a positive integer");
+  }
+  if(opts.edit_threshold < 0) {
+    fail("--edit-threshold must not be negative");
+  }
+  if(opts.distance != "lv" && opts.distance != "osa") {
+    fail("--distance must be one of lv, osa");
+  }
+  if(opts.blocking != "unigram" && opts.blocking != "minhash" &&
+     opts.blocking != "sorted") {
+    fail("--blocking must be one of unigram, minhash, sorted");
+  }
+  if(opts.bands < 1 || opts.rows < 1 || opts.window < 1 ||
+     opts.threads < 1) {
+    fail("--bands, --rows, --window and --threads must be positive "
+         "integers");
+  }
+  if(opts.output != "values" && opts.output != "ids") {
+    fail("--output must be one of values, ids");
+  }
+  if(opts.dict != NULL && opts.method != "kc") {
+    fail("--dict is only used by method kc");
+  }
+  return opts;
+}
+
+
+static void run(const options &opts, cli_progress &prog) {
+  refinr::fingerprinter fp(opts.bus_suffix, opts.ignore_strings);
+  mapped_file input(opts.input_path);
+
+  // Pass one, count the distinct values. Progress of the passes over the
+  // file is counted in bytes.
+  sv_index value_index(1 << 16);
+  std::vector<std::string_view> values;
+  std::vector<double> counts;
+  prog.stage("count", input.size_bytes());
+  input.for_each_line([&](std::string_view line) {
+    int v = value_index.insert(line);
+    if(v == (int)values.size()) {
+      values.push_back(line);
+      counts.push_back(0);
+    }
+    counts[v]++;
+    prog.step(line.size() + 1);
+  });
+  int n_values = values.size();
+
+  bool approx = opts.method == "ngram" && opts.edit_threshold > 0 &&
+    opts.numgram > 1;
+
+  // Key each distinct value, then cluster the values by key. Unigram
+  // blocking needs the unigram key of each value as well, it is cut from the
+  // same normalized string as the ngram key.
+  string_pool keys;
+  std::vector<int> key_ids(n_values);
+  std::string key;
+  bool unigram = approx && opts.blocking == "unigram";
+  string_pool unigram_keys;
+  std::vector<int> unigram_ids(unigram ? n_values : 0);
+  std::vector<int> orders = {opts.numgram, 1};
+  std::vector<std::string> order_keys;
+  prog.stage("fingerprint", n_values);
+  for(int v = 0; v < n_values; ++v) {
+    bool has_key;
+    if(unigram) {
+      fp.ngram_keys(values[v], orders, order_keys);
+      key.swap(order_keys[0]);
+      has_key = !key.empty();
+      unigram_ids[v] = has_key && !order_keys[1].empty() ?
+        unigram_keys.insert(order_keys[1]) : -1;
+    } else if(opts.method == "kc") {
+      has_key = fp.key_collision(values[v], key);
+    } else {
+      has_key = fp.ngram(values[v], opts.numgram, key);
+    }
+    key_ids[v] = has_key ? keys.insert(key) : -1;
+    prog.step();
+  }
+
+  auto value = [&](int v) { return values[v]; };
+  std::vector<int> canonical(n_values);
+  for(int v = 0; v < n_values; ++v) {
+    canonical[v] = v;
+  }
+
+  // Values whose key is found in the dict are replaced with a dict value,
+  // dict_match[v] is the id of that dict value (-1 if none).
+  string_pool dict_values;
+  std::vector<int> dict_match(n_values, -1);
+  if(opts.dict != NULL) {
+    // For each key found in the dict, keep the dict value that sorts first.
+    mapped_file dict(opts.dict);
+    std::vector<int> dict_best;
+    dict.for_each_line([&](std::string_view line) {
+      int n_dict = dict_values.size();
+      int d = dict_values.insert(std::string(line));
+      if(d < n_dict || !fp.key_collision(line, key)) {
+        return;
+      }
+      int k = keys.insert(key);
+      if(k >= (int)dict_best.size()) {
+        dict_best.resize(k + 1, -1);
+      }
+      if(dict_best[k] < 0 || dict_values[d] < dict_values[dict_best[k]]) {
+        dict_best[k] = d;
+      }
+    });
+    for(int v = 0; v < n_values; ++v) {
+      if(key_ids[v] >= 0 && key_ids[v] < (int)dict_best.size()) {
+        dict_match[v] = dict_best[key_ids[v]];
+      }
+    }
+  }
+
+  if(approx) {
+    // Block the values by unigram key, by minhash bucket or by keys matched
+    // within sorted windows, and filter each block by the edit distances
+    // between ngram keys.
+    refinr::edit_distance dist(
+      opts.distance == "osa" ? refinr::edit_distance::osa :
+        refinr::edit_distance::lv,
+      opts.weight
+    );
+    refinr::groups blocks;
+    if(opts.blocking == "minhash") {
+      refinr::minhasher mh(opts.bands, opts.rows);
+      prog.stage("signature", n_values, 1);
+      std::vector<uint64_t> sigs = refinr::minhash_signatures(
+        mh, n_values, opts.numgram,
+        [&](int v, std::string &out) { fp.ngram_normalize(values[v], out); },
+        opts.threads, prog
+      );
+      double n_pairs;
+      prog.stage("bucket", (double)n_values * opts.bands);
+      blocks = mh.buckets(n_values, sigs,
+                          [&](int v) { return key_ids[v] < 0; }, n_pairs,
+                          prog);
+      prog.finish();
+      fprintf(stderr, "refinr: %.0f candidate pairs in %d buckets\n",
+              n_pairs, blocks.size());
+    } else if(opts.blocking == "sorted") {
+      // Sort the keys as is, backwards, and by the normalized string of
+      // their first value, and match keys within the edit threshold of each
+      // other in each window.
+      int n_keys = keys.size();
+      refinr::groups key_values = refinr::build_groups(key_ids, n_keys, 1);
+      refinr::string_arena norms;
+      for(int k = 0; k < n_keys; ++k) {
+        fp.ngram_normalize(values[*key_values.begin(k)], key);
+        norms.push(key);
+      }
+      typedef std::function<std::string_view(int)> sort_key;
+      std::vector<sort_key> sort_keys = {
+        [&](int k) { return keys[k]; },
+        [&](int k) { return keys[k]; },
+        [&](int k) { return norms[k]; }
+      };
+      prog.stage("block", refinr::window_pairs(n_keys, sort_keys.size(),
+                                               opts.window), 1);
+      std::vector<std::vector<int> > orders = refinr::sorted_orders(
+        n_keys, sort_keys, {false, true, false}, opts.threads
+      );
+      refinr::groups key_blocks = refinr::neighbourhood_blocks(
+        n_keys, orders, opts.window,
+        [&](const std::vector<std::pair<int, int> > &pairs,
+            std::vector<double> &out) {
+          out.resize(pairs.size());
+          for(size_t p = 0; p < pairs.size(); ++p) {
+            out[p] = dist(keys[pairs[p].first], keys[pairs[p].second]);
+          }
+        },
+        opts.edit_threshold, prog
+      );
+      // Keep the blocks of keys held by at least two values.
+      for(int g = 0; g < key_blocks.size(); ++g) {
+        size_t start = blocks.members.size();
+        for(const int* k = key_blocks.begin(g); k != key_blocks.end(g);
+            ++k) {
+          blocks.members.insert(blocks.members.end(), key_values.begin(*k),
+                                key_values.end(*k));
+        }
+        if(blocks.members.size() - start < 2) {
+          blocks.members.resize(start);
+        } else {
+          blocks.offsets.push_back(blocks.members.size());
+        }
+      }
+    } else {
+      blocks = refinr::unigram_blocks(key_ids, unigram_ids,
+                                      unigram_keys.size());
+    }
+    prog.stage("distance", refinr::block_pairs(blocks), 1);
+    refinr::groups clusters = refinr::approx_key_clusters(
+      key_ids, keys.size(), blocks,
+      [&](int u, int v) { return dist(keys[key_ids[u]], keys[key_ids[v]]); },
+      opts.edit_threshold, prog
+    );
+    prog.stage("merge", clusters.size());
+    refinr::merge_clusters(clusters, counts, value, canonical, prog);
+  } else {
+    refinr::groups clusters = refinr::key_clusters(key_ids, keys.size());
+    prog.stage("merge", clusters.size());
+    refinr::merge_clusters(clusters, counts, value, canonical, prog);
+  }
+
+  // Pass two, rewrite each line.
+  line_writer output(opts.output_path);
+  bool write_ids = opts.output == "ids";
+  std::vector<int> cluster_ids(n_values, 0);
+  std::vector<int> dict_cluster_ids(dict_values.size(), 0);
+  int n_clusters = 0;
+  char id_buf[16];
+  prog.stage("write", input.size_bytes());
+  input.for_each_line([&](std::string_view line) {
+    prog.step(line.size() + 1);
+    int v = value_index.find(line);
+    int d = dict_match[v];
+    if(!write_ids) {
+      output.write(d >= 0 ? dict_values[d] : values[canonical[v]]);
+      return;
+    }
+    // Number the clusters in order of first appearance. Values replaced with
+    // a dict value share the id of that dict value.
+    int &id = d >= 0 ? dict_cluster_ids[d] : cluster_ids[canonical[v]];
+    if(id == 0) {
+      id = ++n_clusters;
+    }
+    int len = snprintf(id_buf, sizeof(id_buf), "%d", id);
+    output.write(std::string_view(id_buf, len));
+  });
+  output.close();
+}
+
+
+int main(int argc, char** argv) {
+  options opts = parse_args(argc, argv);
+  signal(SIGINT, on_sigint);
+
+  cli_progress prog(opts.progress);
+  try {
+    run(opts, prog);
+  } catch(const refinr::cancelled &) {
+    prog.finish();
+    unlink(opts.output_path);
+    fprintf(stderr, "refinr: cancelled\n");
+    return 130;
+  }
+  prog.finish();
+
+  return 0;
+}
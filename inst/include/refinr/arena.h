@@ -0,0 +1,75 @@
+// Append-only storage for many short strings.
+//
+// Strings are copied back to back into large pages of bytes, and referred to
+// by id, in order of insertion. Holding n strings costs one allocation per
+// page rather than one per string, and strings added one after the other sit
+// next to each other in memory. Pages are never moved, so views of the
+// strings stay valid as more are added. reset() forgets the strings but keeps
+// the pages, so an arena that is reset between uses stops allocating once it
+// has grown to its working size.
+
+#ifndef REFINR_ARENA_H
+#define REFINR_ARENA_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace refinr {
+
+class string_arena {
+public:
+  explicit string_arena(size_t page_size = 65536) : page_size(page_size) {}
+
+  // Copy s into the arena, returns its id.
+  int push(std::string_view s) {
+    char* dst = alloc(s.size());
+    if(!s.empty()) {
+      memcpy(dst, s.data(), s.size());
+    }
+    strings.push_back(std::string_view(dst, s.size()));
+    return strings.size() - 1;
+  }
+
+  std::string_view operator[](int id) const { return strings[id]; }
+  int size() const { return strings.size(); }
+
+  // Forget all strings, keeping the pages for reuse.
+  void reset() {
+    strings.clear();
+    curr_page = 0;
+    page_used = 0;
+  }
+
+private:
+  size_t page_size;
+  std::vector<std::unique_ptr<char[]> > pages;
+  std::vector<size_t> page_sizes;
+  size_t curr_page = 0;
+  size_t page_used = 0;
+  std::vector<std::string_view> strings;
+
+  // Get n contiguous bytes, from the current page if they fit, otherwise
+  // from the next page that has room, or from a new page. Strings longer
+  // than page_size get a page of their own.
+  char* alloc(size_t n) {
+    while(curr_page < pages.size() && page_sizes[curr_page] - page_used < n) {
+      curr_page++;
+      page_used = 0;
+    }
+    if(curr_page == pages.size()) {
+      size_t size = std::max(page_size, n);
+      pages.emplace_back(new char[size]);
+      page_sizes.push_back(size);
+    }
+    char* out = pages[curr_page].get() + page_used;
+    page_used += n;
+    return out;
+  }
+};
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,159 @@
+// Clustering of distinct values, given their fingerprint keys.
+//
+// The functions here work on a table of distinct values, value v having
+// count counts[v]. Keys are passed in as integer ids, key_ids[v] being the
+// id of the key of value v (-1 if v has no key). The result of a merge is a
+// vector "canonical", canonical[v] being the index of the value that v is
+// replaced with.
+
+#ifndef REFINR_CLUSTER_H
+#define REFINR_CLUSTER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "filter.h"
+#include "groups.h"
+#include "progress.h"
+#include "select.h"
+
+namespace refinr {
+
+// Clusters of values that share a key, keeping only keys held by at least
+// two distinct values.
+inline groups key_clusters(const std::vector<int> &key_ids, int n_keys) {
+  return build_groups(key_ids, n_keys, 2);
+}
+
+// Number of pairs of values within the blocks.
+inline double block_pairs(const groups &blocks) {
+  double n_pairs = 0;
+  for(int b = 0; b < blocks.size(); ++b) {
+    n_pairs += (double)blocks.len(b) * (blocks.len(b) - 1) / 2;
+  }
+  return n_pairs;
+}
+
+// Largest block for which approx_key_clusters() holds all distances at once
+// (about 64 MB).
+const int dense_max = 4096;
+
+// Blocks of values that share a unigram key, keeping blocks of at least two
+// values that have an ngram key.
+inline groups unigram_blocks(const std::vector<int> &ngram_ids,
+                             const std::vector<int> &unigram_ids,
+                             int n_unigram_keys) {
+  std::vector<int> block_ids(unigram_ids);
+  for(size_t v = 0; v < block_ids.size(); ++v) {
+    if(ngram_ids[v] < 0) {
+      block_ids[v] = -1;
+    }
+  }
+  return build_groups(block_ids, n_unigram_keys, 2);
+}
+
+// Clusters of values with similar ngram keys. Each block of values (see
+// unigram_blocks() and minhasher::buckets()) is filtered by the edit
+// distances between its ngram keys, see filter_block(). dist(u, v) gives the
+// edit distance between the ngram keys of values u and v. prog is advanced
+// by the number of pairs of each block (see block_pairs()).
+template <class DistFn>
+inline groups approx_key_clusters(const std::vector<int> &ngram_ids,
+                                  int n_ngram_keys,
+                                  const groups &blocks,
+                                  DistFn &&dist,
+                                  double edit_threshold,
+                                  progress &prog = no_progress()) {
+  groups key_groups = build_groups(ngram_ids, n_ngram_keys, 1);
+
+  // Filter each block into clusters of ngram key ids.
+  std::vector<std::vector<int> > clusters;
+  std::vector<int> curr_ids;
+  std::vector<double> lower_tri;
+  for(int b = 0; b < blocks.size(); ++b) {
+    const int* members = blocks.begin(b);
+    int k = blocks.len(b);
+    curr_ids.resize(k);
+    for(int n = 0; n < k; ++n) {
+      curr_ids[n] = ngram_ids[members[n]];
+    }
+    // Blocks of up to dense_max values compute each distance once, and
+    // hold them as a lower triangle. Larger blocks compute each row of
+    // distances on request.
+    bool dense = k <= dense_max;
+    if(dense) {
+      lower_tri.resize((size_t)k * (k - 1) / 2);
+      size_t idx = 0;
+      for(int c = 0; c < k; ++c) {
+        for(int r = c + 1; r < k; ++r) {
+          lower_tri[idx++] = dist(members[c], members[r]);
+        }
+        prog.poll();
+      }
+    }
+    filter_block(
+      curr_ids.data(), k,
+      [&](int r, std::vector<double> &out) {
+        if(!dense) {
+          prog.poll();
+        }
+        out.resize(k);
+        for(int c = 0; c < k; ++c) {
+          if(c == r) {
+            out[c] = 0;
+          } else if(!dense) {
+            out[c] = dist(members[r], members[c]);
+          } else {
+            int i = std::min(r, c);
+            int j = std::max(r, c);
+            out[c] = lower_tri[(size_t)i * (k - 1) - (size_t)i * (i - 1) / 2 +
+                               j - i - 1];
+          }
+        }
+      },
+      edit_threshold, clusters
+    );
+    prog.step((double)k * (k - 1) / 2);
+  }
+
+  // Expand each cluster of keys into the values holding those keys.
+  groups out;
+  for(const std::vector<int> &clust : clusters) {
+    for(int key : clust) {
+      out.members.insert(out.members.end(), key_groups.begin(key),
+                         key_groups.end(key));
+    }
+    out.offsets.push_back(out.members.size());
+  }
+  return out;
+}
+
+// Merge each cluster into its most frequent value (ties are determined by
+// the value that sorts first). value(v) gives the string of value v.
+// canonical must hold one entry per value, and is edited in place, clusters
+// later in the list take precedence over earlier ones. prog is advanced by
+// one step per cluster.
+template <class ValueFn>
+inline void merge_clusters(const groups &clusters,
+                           const std::vector<double> &counts,
+                           ValueFn value,
+                           std::vector<int> &canonical,
+                           progress &prog = no_progress()) {
+  for(int g = 0; g < clusters.size(); ++g) {
+    int mf_idx = most_frequent(
+      clusters.begin(g), clusters.end(g),
+      [&](int v) { return counts[v]; }, value
+    );
+    prog.step();
+    if(mf_idx < 0) {
+      continue;
+    }
+    for(const int* v = clusters.begin(g); v != clusters.end(g); ++v) {
+      canonical[*v] = mf_idx;
+    }
+  }
+}
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,30 @@
+// refinr core library.
+//
+// Header-only implementation of the clustering engine behind refinr, with no
+// dependency on R or Rcpp: fingerprint keys, grouping by key, filtering of
+// approximate clusters by edit distance, sorted neighbourhood blocking,
+// nearest neighbour clustering, and selection of the representative value of
+// each cluster. Everything works on std::string_view and integer ids, so it
+// can run off the R main thread, or be embedded in other C++ programs. Long
+// loops report progress, and can be cancelled, through refinr::progress (see
+// progress.h), and their stages can be profiled with hardware counters (see
+// perf.h). Requires C++17.
+
+#ifndef REFINR_CORE_H
+#define REFINR_CORE_H
+
+#include "fingerprint.h"
+#include "groups.h"
+#include "select.h"
+#include "filter.h"
+#include "distance.h"
+#include "cluster.h"
+#include "keys.h"
+#include "minhash.h"
+#include "knn.h"
+#include "neighbourhood.h"
+#include "progress.h"
+#include "arena.h"
+#include "perf.h"
+
+#endif
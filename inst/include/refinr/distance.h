@@ -0,0 +1,111 @@
+// Weighted edit distances between strings.
+//
+// These are for programs that embed the core library without R, such as the
+// command-line driver. The R functions get their distances from the C API of
+// the stringdist package instead, so that they support all of its methods
+// and args.
+
+#ifndef REFINR_DISTANCE_H
+#define REFINR_DISTANCE_H
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+namespace refinr {
+
+// Decode the UTF-8 string s into code points. Invalid or truncated sequences
+// are decoded one byte at a time.
+inline void utf8_decode(std::string_view s, std::vector<unsigned int> &out) {
+  out.clear();
+  size_t i = 0;
+  size_t s_len = s.size();
+  while(i < s_len) {
+    unsigned char c = s[i];
+    int len = c < 0x80 ? 1 : c >= 0xF0 && c <= 0xF7 ? 4 :
+      c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xC0 ? 2 : 1;
+    if(len == 1 || i + len > s_len) {
+      out.push_back(c);
+      i++;
+      continue;
+    }
+    unsigned int cp = c & (0xFF >> (len + 1));
+    for(int n = 1; n < len; ++n) {
+      cp = (cp << 6) | (s[i + n] & 0x3F);
+    }
+    out.push_back(cp);
+    i += len;
+  }
+}
+
+// Edit distance between two strings, using the same definitions as the
+// "lv" and "osa" methods of the stringdist R package. weight holds the
+// costs of a deletion, insertion, substitution and transposition, in that
+// order (transpositions are only used by "osa"). Strings are compared by
+// UTF-8 code point. The object holds scratch buffers, so one instance should
+// not be shared between threads.
+class edit_distance {
+public:
+  enum method_type { lv, osa };
+
+  edit_distance(method_type method, const double (&weight)[4]) :
+    method(method) {
+    std::copy(weight, weight + 4, this->weight);
+  }
+
+  double operator()(std::string_view a, std::string_view b) {
+    utf8_decode(a, a_cp);
+    utf8_decode(b, b_cp);
+    return distance(a_cp, b_cp);
+  }
+
+  // Distance between two strings that have already been decoded.
+  double distance(const std::vector<unsigned int> &a,
+                  const std::vector<unsigned int> &b) {
+    size_t na = a.size();
+    size_t nb = b.size();
+    if(na == 0) return nb * weight[1];
+    if(nb == 0) return na * weight[0];
+
+    // Full score matrix, (na + 1) rows by (nb + 1) columns, column major.
+    size_t nrow = na + 1;
+    scores.resize(nrow * (nb + 1));
+    for(size_t i = 0; i <= na; ++i) scores[i] = i * weight[0];
+    for(size_t j = 0; j <= nb; ++j) scores[j * nrow] = j * weight[1];
+
+    double sub;
+    double tran;
+    for(size_t i = 1; i <= na; ++i) {
+      for(size_t j = 1; j <= nb; ++j) {
+        if(a[i - 1] == b[j - 1]) {
+          sub = 0;
+          tran = 0;
+        } else {
+          sub = weight[2];
+          tran = weight[3];
+        }
+        double s = std::min(std::min(scores[(i - 1) + j * nrow] + weight[0],
+                                     scores[i + (j - 1) * nrow] + weight[1]),
+                            scores[(i - 1) + (j - 1) * nrow] + sub);
+        if(method == osa && i > 1 && j > 1 &&
+           a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+          s = std::min(s, scores[(i - 2) + (j - 2) * nrow] + tran);
+        }
+        scores[i + j * nrow] = s;
+      }
+    }
+
+    return scores[na + nb * nrow];
+  }
+
+private:
+  method_type method;
+  double weight[4];
+  std::vector<unsigned int> a_cp;
+  std::vector<unsigned int> b_cp;
+  std::vector<double> scores;
+};
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,126 @@
+// Filtering of approximate ngram clusters by edit distance.
+
+#ifndef REFINR_FILTER_H
+#define REFINR_FILTER_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace refinr {
+
+// Is every element of x found in table.
+inline bool all_in(const std::vector<int> &x, const std::vector<int> &table) {
+  if(x.size() > table.size()) {
+    return false;
+  }
+  for(int v : x) {
+    if(std::find(table.begin(), table.end(), v) == table.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Filter one initial cluster (block) of k entries.
+// key_ids[i] identifies the key of entry i, entries with equal keys have
+// equal ids. row(r, out) fills out with the edit distances between entry r
+// and every entry of the block (including the zero distance of r to itself).
+// Using the distances, create clusters of matches within the block, based on
+// lowest numeric edit distance (matches must have a value below
+// edit_threshold in order to be considered a cluster suitable for merging).
+// Each resulting cluster is a vector of unique key ids, and is appended to
+// out.
+template <class RowFn>
+inline void filter_block(const int* key_ids, int k, RowFn &&row,
+                         double edit_threshold,
+                         std::vector<std::vector<int> > &out) {
+  std::vector<int> lows_idx;
+  std::vector<int> olap;
+  std::vector<double> curr_row;
+  double lowest;
+  int lowest_count;
+
+  // For each row of the distance matrix, get the min value present,
+  // excluding the distance of the entry to itself. Record the rows that have
+  // a min value below the edit_threshold, and the number of times the min
+  // value appears within each of those rows (a min value that repeats means
+  // the row has more than one cluster match).
+  for(int row_idx = 0; row_idx < k; ++row_idx) {
+    row(row_idx, curr_row);
+    lowest = std::numeric_limits<double>::infinity();
+    for(int n = 0; n < k; ++n) {
+      if(n != row_idx && curr_row[n] < lowest) {
+        lowest = curr_row[n];
+      }
+    }
+    if(lowest < edit_threshold) {
+      lowest_count = 0;
+      for(int n = 0; n < k; ++n) {
+        if(n != row_idx && curr_row[n] == lowest) {
+          lowest_count++;
+        }
+      }
+      olap.push_back(lowest_count);
+      lows_idx.push_back(row_idx);
+    }
+  }
+
+  // If none of the rows contain an edit distance value below the
+  // edit_threshold, there are no clusters.
+  int lows_idx_len = lows_idx.size();
+  if(lows_idx_len == 0) {
+    return;
+  }
+
+  // Generate clusters of keys based on the edit distance values. Drop any
+  // cluster that is a complete subset of an earlier one.
+  std::vector<std::vector<int> > clust(lows_idx_len);
+  std::vector<int> kept;
+  for(int n = 0; n < lows_idx_len; ++n) {
+    row(lows_idx[n], curr_row);
+    std::vector<int> &terms = clust[n];
+    for(int c = 0; c < k; ++c) {
+      if(curr_row[c] < edit_threshold &&
+         std::find(terms.begin(), terms.end(), key_ids[c]) == terms.end()) {
+        terms.push_back(key_ids[c]);
+      }
+    }
+    bool is_subset = false;
+    for(int j = 0; j < n; ++j) {
+      if(all_in(terms, clust[j])) {
+        is_subset = true;
+        break;
+      }
+    }
+    if(!is_subset) {
+      kept.push_back(n);
+    }
+  }
+
+  // If any rows have a min edit distance that repeats, eliminate any
+  // clusters that are complete subsets of the longest cluster of the group.
+  bool any_olap = false;
+  int max_clust_idx = -1;
+  for(int n : kept) {
+    if(olap[n] > 1) {
+      any_olap = true;
+    }
+    if(max_clust_idx < 0 || clust[n].size() > clust[max_clust_idx].size()) {
+      max_clust_idx = n;
+    }
+  }
+  bool trim_subsets = any_olap && kept.size() > 1;
+
+  for(int n : kept) {
+    if(trim_subsets && n != max_clust_idx &&
+       all_in(clust[n], clust[max_clust_idx])) {
+      continue;
+    }
+    out.push_back(clust[n]);
+  }
+}
+
+} // namespace refinr
+
+#endif
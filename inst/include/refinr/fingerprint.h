@@ -0,0 +1,369 @@
+// Fingerprint keys for key collision and ngram clustering.
+//
+// These are the normalization steps of the key collision and ngram
+// fingerprint methods from OpenRefine, working on UTF-8 or ASCII bytes.
+// Ngrams are cut on UTF-8 character boundaries.
+// Accent folding is not part of this header, input strings are expected to
+// have been transliterated to ASCII where possible before fingerprinting.
+
+#ifndef REFINR_FINGERPRINT_H
+#define REFINR_FINGERPRINT_H
+
+#include <algorithm>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace refinr {
+
+// Abbreviated business name suffixes, ignored during clustering when the
+// bus_suffix option is on.
+inline const std::vector<std::string> &suffix_strings() {
+  static const std::vector<std::string> out = {
+    "inc", "corp", "co", "llc", "ltd", "div", "ent", "lp", "and"
+  };
+  return out;
+}
+
+// Character classes, matching PCRE's ASCII [[:punct:]] and \w.
+inline bool is_punct(unsigned char c) {
+  return (c >= 33 && c <= 47) || (c >= 58 && c <= 64) ||
+    (c >= 91 && c <= 96) || (c >= 123 && c <= 126);
+}
+
+inline bool is_word(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9') || c == '_';
+}
+
+inline bool is_trim_space(unsigned char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline char to_lower_ascii(char c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Number of bytes in the UTF-8 sequence starting with lead byte c. Invalid
+// lead bytes are treated as single byte characters.
+inline int utf8_char_len(unsigned char c) {
+  if(c < 0x80) return 1;
+  if(c >= 0xF0 && c <= 0xF7) return 4;
+  if(c >= 0xE0) return c <= 0xEF ? 3 : 1;
+  if(c >= 0xC0) return 2;
+  return 1;
+}
+
+// Is every byte of s ASCII. The bytes are OR-ed together without a branch
+// per byte, so the loop vectorizes.
+inline bool is_ascii(std::string_view s) {
+  unsigned char acc = 0;
+  for(char c : s) {
+    acc |= (unsigned char)c;
+  }
+  return acc < 0x80;
+}
+
+// Call f(gram) for each ngram of numgram characters of the UTF-8 string s,
+// left to right, gram being a view into s. A string of fewer than numgram
+// characters has no ngrams. ASCII strings are cut into byte substrings
+// directly. Other strings are first decoded into the byte offsets of their
+// characters, held in starts, so that no ngram splits a multi-byte
+// character.
+template <class Fn>
+inline void char_ngrams(std::string_view s, int numgram,
+                        std::vector<size_t> &starts, Fn f) {
+  size_t k = std::max(numgram, 1);
+  if(is_ascii(s)) {
+    for(size_t i = 0; i + k <= s.size(); ++i) {
+      f(s.substr(i, k));
+    }
+    return;
+  }
+  starts.clear();
+  size_t i = 0;
+  while(i < s.size()) {
+    starts.push_back(i);
+    i += utf8_char_len(s[i]);
+  }
+  starts.push_back(s.size());
+  for(size_t j = 0; j + k < starts.size(); ++j) {
+    f(s.substr(starts[j], starts[j + k] - starts[j]));
+  }
+}
+
+// Replace, left to right, every non-overlapping match of any of alts in s
+// with repl. At each position the alternatives are tried in order and the
+// first one that matches wins, same as a regex alternation. If at_end, only
+// a match that ends the string is replaced. The result is built in spare,
+// then swapped into s, so the buffers trade places and neither is freed.
+inline void replace_alternatives(std::string &s,
+                                 std::initializer_list<std::string_view> alts,
+                                 std::string_view repl,
+                                 std::string &spare,
+                                 bool at_end = false) {
+  // Skip strings that don't contain the prefix shared by all alternatives.
+  std::string_view prefix = *alts.begin();
+  for(std::string_view alt : alts) {
+    size_t n = 0;
+    while(n < prefix.size() && n < alt.size() && prefix[n] == alt[n]) {
+      n++;
+    }
+    prefix = prefix.substr(0, n);
+  }
+  if(s.find(prefix) == std::string::npos) {
+    return;
+  }
+
+  std::string &out = spare;
+  out.clear();
+  size_t i = 0;
+  size_t s_len = s.size();
+  while(i < s_len) {
+    bool matched = false;
+    for(std::string_view alt : alts) {
+      if(s.compare(i, alt.size(), alt) == 0 &&
+         (!at_end || i + alt.size() == s_len)) {
+        out += repl;
+        i += alt.size();
+        matched = true;
+        break;
+      }
+    }
+    if(!matched) {
+      out += s[i];
+      i++;
+    }
+  }
+  s.swap(out);
+}
+
+// Merge common business name suffixes within s, spare being a scratch
+// buffer (see replace_alternatives()).
+inline void business_suffix(std::string &s, std::string &spare) {
+  replace_alternatives(s, {" incorporated", " incorporate"}, " inc", spare);
+  replace_alternatives(s, {" corporation", " corporations"}, " corp", spare);
+  replace_alternatives(s, {" company", " companys", " companies"}, " co",
+                       spare);
+  replace_alternatives(s, {" limited liability co"}, " llc", spare);
+  replace_alternatives(s, {" limited"}, " ltd", spare, true);
+  replace_alternatives(s, {" division", " divisions"}, " div", spare);
+  replace_alternatives(s, {" enterprises", " enterprise"}, " ent", spare);
+  replace_alternatives(s, {" limited partnership"}, " lp", spare);
+}
+
+// Computes fingerprint keys with one set of options. The options are
+// compiled once at construction, after which the object is read only and
+// can be shared between threads.
+//
+// The intermediate text of a key (the normalized string, and the tokens or
+// ngrams, which are views into it) lives in a workspace of buffers owned by
+// the calling thread. The buffers are cleared rather than freed between
+// calls, so keying a vector of values allocates only until they have grown
+// to fit the longest value.
+class fingerprinter {
+public:
+  // ignore_strings are expected to be lower case. If bus_suffix, the
+  // abbreviated business suffixes are ignored as well.
+  fingerprinter(bool bus_suffix,
+                const std::vector<std::string> &ignore_strings) :
+    bus_suffix(bus_suffix), ignores(ignore_strings) {
+    if(bus_suffix) {
+      const std::vector<std::string> &suffixes = suffix_strings();
+      ignores.insert(ignores.end(), suffixes.begin(), suffixes.end());
+    }
+    // Empty strings can't match a token.
+    ignores.erase(std::remove(ignores.begin(), ignores.end(), std::string()),
+                  ignores.end());
+    sorted_ignores = ignores;
+    std::sort(sorted_ignores.begin(), sorted_ignores.end());
+  }
+
+  // Key collision fingerprint of s: lower case, strip punctuation, merge
+  // business suffixes, split into tokens on spaces, drop ignored tokens, then
+  // join the unique tokens in sorted order. Writes the key to out, returns
+  // false if s has no tokens left (the key is NA).
+  bool key_collision(std::string_view s, std::string &out) const {
+    workspace &ws = local_workspace();
+    std::string &norm = ws.norm;
+    norm.clear();
+    for(char c : s) {
+      c = to_lower_ascii(c);
+      if(c == ';' || c == '\'' || c == '`' || c == '"') {
+        continue;
+      }
+      if(is_punct(c)) {
+        c = ' ';
+      }
+      // Collapse runs of spaces.
+      if(c == ' ' && !norm.empty() && norm.back() == ' ') {
+        continue;
+      }
+      norm += c;
+    }
+    if(bus_suffix) {
+      business_suffix(norm, ws.spare);
+    }
+
+    // Trim leading white space, then split on single spaces. A trailing
+    // space does not produce an empty token.
+    size_t start = 0;
+    while(start < norm.size() && is_trim_space(norm[start])) {
+      start++;
+    }
+    std::vector<std::string_view> &tokens = ws.parts;
+    tokens.clear();
+    std::string_view rest(norm);
+    rest.remove_prefix(start);
+    while(!rest.empty()) {
+      size_t pos = rest.find(' ');
+      std::string_view token = rest.substr(0, pos);
+      if(!is_ignored(token)) {
+        tokens.push_back(token);
+      }
+      if(pos == std::string_view::npos) {
+        break;
+      }
+      rest.remove_prefix(pos + 1);
+    }
+
+    return join_unique(tokens, " ", out);
+  }
+
+  // The normalized string that ngram fingerprints are built from: lower
+  // case, strip punctuation, merge business suffixes, then remove ignored
+  // words and all spaces.
+  void ngram_normalize(std::string_view s, std::string &out) const {
+    workspace &ws = local_workspace();
+    std::string &norm = ws.norm;
+    norm.clear();
+    for(char c : s) {
+      c = to_lower_ascii(c);
+      if(c == ';' || c == '\'' || c == '`' || c == '"') {
+        continue;
+      }
+      norm += is_punct(c) ? ' ' : c;
+    }
+    if(bus_suffix) {
+      business_suffix(norm, ws.spare);
+    }
+
+    // Remove every ignored word that starts and ends on a word boundary,
+    // trying the words in order at each position, and every space.
+    out.clear();
+    size_t i = 0;
+    size_t norm_len = norm.size();
+    while(i < norm_len) {
+      if(!ignores.empty() && is_boundary(norm, i)) {
+        size_t match_len = 0;
+        for(const std::string &ign : ignores) {
+          if(norm.compare(i, ign.size(), ign) == 0 &&
+             is_boundary(norm, i + ign.size())) {
+            match_len = ign.size();
+            break;
+          }
+        }
+        if(match_len > 0) {
+          i += match_len;
+          continue;
+        }
+      }
+      if(norm[i] != ' ') {
+        out += norm[i];
+      }
+      i++;
+    }
+  }
+
+  // Ngram fingerprint of s: the unique ngrams of numgram UTF-8 characters of
+  // the normalized string, joined in sorted order. Writes the key to out,
+  // returns false if the normalized string is shorter than numgram
+  // characters (the key is NA).
+  bool ngram(std::string_view s, int numgram, std::string &out) const {
+    std::string &norm = local_workspace().cleaned;
+    ngram_normalize(s, norm);
+    return ngram_key(norm, numgram, out);
+  }
+
+  // Ngram fingerprints of s of several orders, normalizing s only once.
+  // outs[k] is set to the key of order numgrams[k], or to an empty string if
+  // there is none (see ngram()).
+  void ngram_keys(std::string_view s, const std::vector<int> &numgrams,
+                  std::vector<std::string> &outs) const {
+    std::string &norm = local_workspace().cleaned;
+    ngram_normalize(s, norm);
+    outs.resize(numgrams.size());
+    for(size_t k = 0; k < numgrams.size(); ++k) {
+      ngram_key(norm, numgrams[k], outs[k]);
+    }
+  }
+
+  // Ngram fingerprint of a string that has already been normalized by
+  // ngram_normalize().
+  static bool ngram_key(std::string_view norm, int numgram,
+                        std::string &out) {
+    workspace &ws = local_workspace();
+    std::vector<std::string_view> &grams = ws.parts;
+    grams.clear();
+    char_ngrams(norm, numgram, ws.starts,
+                [&](std::string_view gram) { grams.push_back(gram); });
+    return join_unique(grams, "", out);
+  }
+
+private:
+  bool bus_suffix;
+  std::vector<std::string> ignores;
+  std::vector<std::string> sorted_ignores;
+
+  struct workspace {
+    std::string norm;
+    std::string spare;
+    std::string cleaned;
+    std::vector<std::string_view> parts;
+    std::vector<size_t> starts;
+  };
+
+  // The workspace of the calling thread.
+  static workspace &local_workspace() {
+    thread_local workspace ws;
+    return ws;
+  }
+
+  bool is_ignored(std::string_view token) const {
+    return std::binary_search(sorted_ignores.begin(), sorted_ignores.end(),
+                              token,
+                              [](std::string_view a, std::string_view b) {
+                                return a < b;
+                              });
+  }
+
+  // Is there a word boundary (\b) before position i of s.
+  static bool is_boundary(const std::string &s, size_t i) {
+    bool before = i > 0 && is_word(s[i - 1]);
+    bool after = i < s.size() && is_word(s[i]);
+    return before != after;
+  }
+
+  // Sort parts (byte order), drop duplicates, and join them with sep into
+  // out. Returns false if there are no parts.
+  static bool join_unique(std::vector<std::string_view> &parts,
+                          std::string_view sep, std::string &out) {
+    out.clear();
+    if(parts.empty()) {
+      return false;
+    }
+    std::sort(parts.begin(), parts.end());
+    parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+    out += parts[0];
+    for(size_t i = 1; i < parts.size(); ++i) {
+      out += sep;
+      out += parts[i];
+    }
+    return true;
+  }
+};
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,180 @@
+// Grouping of element indices by key, in compressed sparse row form.
+
+#ifndef REFINR_GROUPS_H
+#define REFINR_GROUPS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace refinr {
+
+// Grouping index in compressed sparse row form. The element indices of group
+// g are stored contiguously in members[offsets[g]] through
+// members[offsets[g + 1] - 1], in ascending order.
+struct groups {
+  std::vector<int> offsets;
+  std::vector<int> members;
+
+  groups() : offsets(1, 0) {}
+
+  int size() const { return offsets.size() - 1; }
+  int len(int g) const { return offsets[g + 1] - offsets[g]; }
+  const int* begin(int g) const { return members.data() + offsets[g]; }
+  const int* end(int g) const { return members.data() + offsets[g + 1]; }
+
+  // Append a group holding the indices [first, last).
+  void push_back(const int* first, const int* last) {
+    members.insert(members.end(), first, last);
+    offsets.push_back(members.size());
+  }
+};
+
+// Build a grouping index from a vector of group ids, one id per element
+// (elements with an id less than zero are skipped). Only groups with at least
+// min_size members are kept, in order of id.
+inline groups build_groups(const std::vector<int> &ids,
+                           int n_ids,
+                           int min_size) {
+  int ids_len = ids.size();
+
+  // Counting pass, get the size of each group.
+  std::vector<int> counts(n_ids, 0);
+  for(int i = 0; i < ids_len; ++i) {
+    if(ids[i] >= 0) {
+      counts[ids[i]]++;
+    }
+  }
+
+  // Renumber the groups being kept, and compute the offset of each group
+  // within the members array.
+  groups out;
+  std::vector<int> new_id(n_ids, -1);
+  int n_kept = 0;
+  int total = 0;
+  out.offsets.reserve(n_ids + 1);
+  for(int g = 0; g < n_ids; ++g) {
+    if(counts[g] >= min_size) {
+      new_id[g] = n_kept;
+      n_kept++;
+      total += counts[g];
+      out.offsets.push_back(total);
+    }
+  }
+
+  // Fill pass, write each element index into the span of its group.
+  out.members.resize(total);
+  std::vector<int> cursor(out.offsets.begin(), out.offsets.end() - 1);
+  int g;
+  for(int i = 0; i < ids_len; ++i) {
+    if(ids[i] < 0) {
+      continue;
+    }
+    g = new_id[ids[i]];
+    if(g >= 0) {
+      out.members[cursor[g]] = i;
+      cursor[g]++;
+    }
+  }
+
+  return out;
+}
+
+// Open addressing hash index, mapping keys onto dense integer ids in order of
+// first insertion. All slots live in one flat array, so lookups and inserts
+// never allocate per key. Key must be cheap to copy and comparable with ==,
+// Hash must map a Key to a well mixed size_t. The index does not own the data
+// behind the keys, e.g. string_view keys must outlive the index.
+template <class Key, class Hash = std::hash<Key> >
+class key_index {
+public:
+  explicit key_index(size_t n_keys) : n_ids(0) {
+    size_t cap = 16;
+    while(cap < n_keys * 2) cap <<= 1;
+    mask = cap - 1;
+    slots.assign(cap, slot_type(Key(), -1));
+  }
+
+  // Return the id of key x. If x is not in the index yet, insert it with the
+  // next free id.
+  int insert(const Key &x) {
+    size_t i = Hash()(x) & mask;
+    while(slots[i].second >= 0) {
+      if(slots[i].first == x) return slots[i].second;
+      i = (i + 1) & mask;
+    }
+    if((size_t)n_ids * 2 >= mask) {
+      grow();
+      return insert(x);
+    }
+    slots[i].first = x;
+    slots[i].second = n_ids;
+    n_ids++;
+    return n_ids - 1;
+  }
+
+  // Return the id of key x, or -1 if x is not in the index.
+  int find(const Key &x) const {
+    size_t i = Hash()(x) & mask;
+    while(slots[i].second >= 0) {
+      if(slots[i].first == x) return slots[i].second;
+      i = (i + 1) & mask;
+    }
+    return -1;
+  }
+
+  // Number of distinct keys inserted.
+  int size() const { return n_ids; }
+
+  // Forget all keys, making room for n_keys keys. The slot array is kept
+  // when it is large enough, so an index that is reset between uses stops
+  // allocating once it has grown to its working size.
+  void reset(size_t n_keys) {
+    size_t cap = 16;
+    while(cap < n_keys * 2) cap <<= 1;
+    cap = std::max(cap, slots.size());
+    mask = cap - 1;
+    slots.assign(cap, slot_type(Key(), -1));
+    n_ids = 0;
+  }
+
+private:
+  typedef std::pair<Key, int> slot_type;
+  std::vector<slot_type> slots;
+  size_t mask;
+  int n_ids;
+
+  void grow() {
+    std::vector<slot_type> old;
+    old.swap(slots);
+    mask = old.size() * 2 - 1;
+    slots.assign(old.size() * 2, slot_type(Key(), -1));
+    for(const slot_type &s : old) {
+      if(s.second < 0) continue;
+      size_t i = Hash()(s.first) & mask;
+      while(slots[i].second >= 0) i = (i + 1) & mask;
+      slots[i] = s;
+    }
+  }
+};
+
+// Group element indices by key. keys[i] is the key of element i, elements
+// for which skip(i) is true are left out. Groups are numbered in order of
+// first appearance, and only groups with at least min_size members are kept.
+template <class Key, class Hash, class Skip>
+inline groups group_by_key(const std::vector<Key> &keys,
+                           Skip skip,
+                           int min_size) {
+  key_index<Key, Hash> index(keys.size());
+  std::vector<int> ids(keys.size());
+  for(size_t i = 0; i < keys.size(); ++i) {
+    ids[i] = skip(i) ? -1 : index.insert(keys[i]);
+  }
+  return build_groups(ids, index.size(), min_size);
+}
+
+} // namespace refinr
+
+#endif
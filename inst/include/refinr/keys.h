@@ -0,0 +1,205 @@
+// Hashed fingerprint keys.
+//
+// Rather than comparing one heap string per element, elements are grouped on
+// a 64 bit hash of their key. The keys themselves are stored back to back in
+// a string arena (see arena.h), and only compared as strings within groups
+// that hold more than one element, to split apart elements whose keys
+// collide on the hash.
+
+#ifndef REFINR_KEYS_H
+#define REFINR_KEYS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "fingerprint.h"
+#include "groups.h"
+#include "progress.h"
+
+namespace refinr {
+
+// 64 bit hash of the bytes of s (MurmurHash64A).
+inline uint64_t hash_bytes(std::string_view s, uint64_t seed = 0) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  size_t len = s.size();
+  const unsigned char* data = (const unsigned char*)s.data();
+  const unsigned char* end = data + (len / 8) * 8;
+  uint64_t h = seed ^ (len * m);
+
+  for( ; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  switch(len & 7) {
+  case 7: h ^= uint64_t(data[6]) << 48; // fall through
+  case 6: h ^= uint64_t(data[5]) << 40; // fall through
+  case 5: h ^= uint64_t(data[4]) << 32; // fall through
+  case 4: h ^= uint64_t(data[3]) << 24; // fall through
+  case 3: h ^= uint64_t(data[2]) << 16; // fall through
+  case 2: h ^= uint64_t(data[1]) << 8;  // fall through
+  case 1: h ^= uint64_t(data[0]);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Hash for keys that are already well mixed 64 bit hashes.
+struct u64_hash {
+  size_t operator()(uint64_t x) const { return (size_t)x; }
+};
+
+// Give the elements of each group of ids that share a hashed key (see
+// hashed_key_ids()) but differ in their key strings new ids, one per
+// distinct key. key(i, buf) returns a view of the key of element i, which
+// may be written to buf and point into it. Returns the new number of
+// distinct keys. prog is polled once per element checked.
+template <class KeyFn>
+inline int split_key_collisions(std::vector<int> &ids, int n_ids,
+                                KeyFn &&key, progress &prog = no_progress()) {
+  // Verify each group of more than one element. Elements whose key differs
+  // from the key of the first element of the group get new ids, one per
+  // distinct key. Collisions are rare, so the keys split off from a group
+  // are kept in an arena and searched linearly, their ids starting at
+  // split_first.
+  groups dups = build_groups(ids, n_ids, 2);
+  std::string first_buf;
+  std::string buf;
+  string_arena split_keys;
+  int split_first;
+  for(int g = 0; g < dups.size(); ++g) {
+    const int* members = dups.begin(g);
+    std::string_view first_key = key(members[0], first_buf);
+    split_keys.reset();
+    split_first = n_ids;
+    for(int j = 1; j < dups.len(g); ++j) {
+      prog.step(0);
+      std::string_view k = key(members[j], buf);
+      if(k == first_key) {
+        continue;
+      }
+      int s = 0;
+      while(s < split_keys.size() && split_keys[s] != k) {
+        s++;
+      }
+      if(s == split_keys.size()) {
+        split_keys.push(k);
+        n_ids++;
+      }
+      ids[members[j]] = split_first + s;
+    }
+  }
+
+  return n_ids;
+}
+
+// Assign a key id to each of n elements, ids[i] being -1 if element i has no
+// key. key(i, out) writes the key of element i to out, and returns false if
+// there is none. Keys are numbered in order of first appearance, except for
+// keys split off by a hash collision, which are numbered last. Returns the
+// number of distinct keys. prog is advanced by one step per element.
+//
+// Each key is computed once, into a buffer that is reused from one element
+// to the next, and appended to the arena keys, element i's key being
+// keys[i] (empty if it has none). Hash collisions are then checked against
+// the arena rather than by keying the elements again. keys is reset first.
+template <class KeyFn>
+inline int hashed_key_ids(int n, KeyFn &&key, std::vector<int> &ids,
+                          string_arena &keys,
+                          progress &prog = no_progress()) {
+  key_index<uint64_t, u64_hash> index(n);
+  std::string buf;
+  ids.resize(n);
+  keys.reset();
+  for(int i = 0; i < n; ++i) {
+    if(key(i, buf)) {
+      ids[i] = index.insert(hash_bytes(buf));
+      keys.push(buf);
+    } else {
+      ids[i] = -1;
+      keys.push(std::string_view());
+    }
+    prog.step();
+  }
+  return split_key_collisions(
+    ids, index.size(),
+    [&](int i, std::string &) { return keys[i]; },
+    prog
+  );
+}
+
+// hashed_key_ids() with an arena of its own, for callers that don't need
+// the keys afterwards.
+template <class KeyFn>
+inline int hashed_key_ids(int n, KeyFn &&key, std::vector<int> &ids,
+                          progress &prog = no_progress()) {
+  string_arena keys;
+  return hashed_key_ids(n, key, ids, keys, prog);
+}
+
+// Ngram key ids of n strings for several orders at once, input(i) giving
+// string i. Each string is normalized once (see
+// fingerprinter::ngram_normalize()), and its keys of every order are cut
+// from the normalized string in the same pass. ids[k] is set to the key ids
+// of order numgrams[k], numbered as in hashed_key_ids(), and the number of
+// distinct keys of each order is returned. The normalized strings are kept
+// in norms, in order, so that keys can be cut from them again later with
+// fingerprinter::ngram_key(). prog is advanced by one step per string.
+template <class InputFn>
+inline std::vector<int> ngram_key_ids(const fingerprinter &fp, int n,
+                                      InputFn input,
+                                      const std::vector<int> &numgrams,
+                                      string_arena &norms,
+                                      std::vector<std::vector<int> > &ids,
+                                      progress &prog = no_progress()) {
+  int n_orders = numgrams.size();
+  std::vector<key_index<uint64_t, u64_hash> > index;
+  index.reserve(n_orders);
+  for(int k = 0; k < n_orders; ++k) {
+    index.emplace_back(n);
+  }
+  ids.assign(n_orders, std::vector<int>(n));
+  norms.reset();
+  std::string norm;
+  std::string key;
+  for(int i = 0; i < n; ++i) {
+    fp.ngram_normalize(input(i), norm);
+    norms.push(norm);
+    for(int k = 0; k < n_orders; ++k) {
+      ids[k][i] = fingerprinter::ngram_key(norm, numgrams[k], key) ?
+        index[k].insert(hash_bytes(key)) : -1;
+    }
+    prog.step();
+  }
+
+  std::vector<int> n_ids(n_orders);
+  for(int k = 0; k < n_orders; ++k) {
+    n_ids[k] = split_key_collisions(
+      ids[k], index[k].size(),
+      [&](int i, std::string &buf) {
+        fingerprinter::ngram_key(norms[i], numgrams[k], buf);
+        return std::string_view(buf);
+      },
+      prog
+    );
+  }
+  return n_ids;
+}
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,400 @@
+// Nearest neighbour clustering, as in the kNN methods of OpenRefine.
+//
+// Values are blocked on the substrings of block_chars characters of their
+// normalized strings, and the values of each block are compared pairwise
+// under a distance. Values within radius of each other are neighbours, and
+// each value forms a cluster with its neighbours. Each pair of values is
+// compared once, however many blocks it shares, either in parallel on
+// threads of the caller, or in batches passed to a distance function that
+// runs its own threads.
+
+#ifndef REFINR_KNN_H
+#define REFINR_KNN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "fingerprint.h"
+#include "groups.h"
+#include "keys.h"
+#include "progress.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace refinr {
+
+// Normalized compression distance under an order 2 PPM model, the distance
+// of the PPM method of OpenRefine:
+// d(a, b) = 10 * ((C(ab) + C(ba)) / (C(aa) + C(bb)) - 1), C(s) being the
+// size in bits of s after PPM compression. Sizes are those of ideal
+// arithmetic coding, so no bits are written. The object holds scratch
+// buffers, so one instance should not be shared between threads.
+class ppm_distance {
+public:
+  ppm_distance() : ctx_index(0), sym_index(0) {}
+
+  double operator()(std::string_view a, std::string_view b) {
+    double self = bits(a, a) + bits(b, b);
+    if(self <= 0) {
+      return 0;
+    }
+    double d = 10 * ((bits(a, b) + bits(b, a)) / self - 1);
+    return std::max(d, 0.0);
+  }
+
+private:
+  static const int order = 2;
+
+  // Mixes the packed context and symbol keys below, whose low bits alone
+  // are poorly spread.
+  struct mix_hash {
+    size_t operator()(uint64_t x) const {
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdULL;
+      x ^= x >> 33;
+      return (size_t)x;
+    }
+  };
+
+  // The contexts seen so far, ctx holding the context order in its high
+  // byte and the preceding bytes in its low bytes, with the total count and
+  // the number of distinct symbols seen after each. Then the count of each
+  // symbol sym seen after context ctx, keyed by (ctx << 8) | sym.
+  key_index<uint64_t, mix_hash> ctx_index;
+  std::vector<double> ctx_total;
+  std::vector<double> ctx_distinct;
+  key_index<uint64_t, mix_hash> sym_index;
+  std::vector<double> sym_count;
+
+  // Size in bits of the concatenation of a and b, coded one byte at a time.
+  // Each byte is coded in the longest context that has seen it, escaping
+  // down from order 2 (PPM method C, without exclusions). Bytes never seen
+  // in any context cost 8 bits.
+  double bits(std::string_view a, std::string_view b) {
+    size_t n = a.size() + b.size();
+    ctx_index.reset((order + 1) * n);
+    sym_index.reset((order + 1) * n);
+    ctx_total.clear();
+    ctx_distinct.clear();
+    sym_count.clear();
+    auto at = [&](size_t i) {
+      return (unsigned char)(i < a.size() ? a[i] : b[i - a.size()]);
+    };
+    auto context = [&](size_t i, int k) {
+      uint32_t ctx = (uint32_t)k << 24;
+      for(int j = 1; j <= k; ++j) {
+        ctx |= (uint32_t)at(i - j) << (8 * (j - 1));
+      }
+      return ctx;
+    };
+
+    double out = 0;
+    for(size_t i = 0; i < n; ++i) {
+      unsigned char c = at(i);
+      int max_k = (int)std::min<size_t>(order, i);
+      bool coded = false;
+      for(int k = max_k; k >= 0 && !coded; --k) {
+        uint32_t ctx = context(i, k);
+        int cid = ctx_index.find(ctx);
+        if(cid < 0) {
+          continue;
+        }
+        double total = ctx_total[cid];
+        double distinct = ctx_distinct[cid];
+        int sid = sym_index.find(((uint64_t)ctx << 8) | c);
+        if(sid >= 0) {
+          out -= std::log2(sym_count[sid] / (total + distinct));
+          coded = true;
+        } else {
+          out -= std::log2(distinct / (total + distinct));
+        }
+      }
+      if(!coded) {
+        out += 8;
+      }
+
+      for(int k = 0; k <= max_k; ++k) {
+        uint32_t ctx = context(i, k);
+        int cid = ctx_index.insert(ctx);
+        if(cid == (int)ctx_total.size()) {
+          ctx_total.push_back(0);
+          ctx_distinct.push_back(0);
+        }
+        int sid = sym_index.insert(((uint64_t)ctx << 8) | c);
+        if(sid == (int)sym_count.size()) {
+          sym_count.push_back(0);
+          ctx_distinct[cid]++;
+        }
+        sym_count[sid]++;
+        ctx_total[cid]++;
+      }
+    }
+    return out;
+  }
+};
+
+// Blocking of n values for nearest neighbour clustering.
+struct knn_blocking {
+  // The values of each block, blocks of at least two values only.
+  groups blocks;
+  // The ids of the blocks of each value, in ascending order.
+  groups value_blocks;
+};
+
+// Block n values on the substrings of block_chars UTF-8 characters of their
+// normalized strings, norm(v) giving the normalized string of value v. A
+// string no longer than block_chars is one substring, and an empty string
+// is in no block. Blocks are numbered in order of first appearance. prog is
+// advanced by one step per value.
+template <class NormFn>
+inline knn_blocking knn_blocks(int n, NormFn norm, int block_chars,
+                               progress &prog = no_progress()) {
+  // Substring ids of each value, in compressed sparse row form.
+  key_index<uint64_t, u64_hash> index(n);
+  groups grams;
+  std::vector<size_t> starts;
+  for(int v = 0; v < n; ++v) {
+    std::string_view s = norm(v);
+    size_t start = grams.members.size();
+    char_ngrams(s, block_chars, starts, [&](std::string_view gram) {
+      grams.members.push_back(index.insert(hash_bytes(gram)));
+    });
+    if(grams.members.size() == start && !s.empty()) {
+      grams.members.push_back(index.insert(hash_bytes(s)));
+    }
+    std::sort(grams.members.begin() + start, grams.members.end());
+    grams.members.erase(
+      std::unique(grams.members.begin() + start, grams.members.end()),
+      grams.members.end()
+    );
+    grams.offsets.push_back(grams.members.size());
+    prog.step();
+  }
+
+  // Keep the substrings held by at least two values as blocks, renumbered
+  // in the same order.
+  int n_grams = index.size();
+  std::vector<int> block_ids(n_grams, 0);
+  for(int g : grams.members) {
+    block_ids[g]++;
+  }
+  int n_blocks = 0;
+  for(int g = 0; g < n_grams; ++g) {
+    block_ids[g] = block_ids[g] >= 2 ? n_blocks++ : -1;
+  }
+
+  knn_blocking out;
+  std::vector<int> sizes(n_blocks, 0);
+  for(int v = 0; v < n; ++v) {
+    for(const int* g = grams.begin(v); g != grams.end(v); ++g) {
+      if(block_ids[*g] >= 0) {
+        out.value_blocks.members.push_back(block_ids[*g]);
+        sizes[block_ids[*g]]++;
+      }
+    }
+    out.value_blocks.offsets.push_back(out.value_blocks.members.size());
+  }
+  out.blocks.offsets.resize(n_blocks + 1);
+  for(int b = 0; b < n_blocks; ++b) {
+    out.blocks.offsets[b + 1] = out.blocks.offsets[b] + sizes[b];
+  }
+  out.blocks.members.resize(out.blocks.offsets[n_blocks]);
+  std::vector<int> pos(out.blocks.offsets.begin(),
+                       out.blocks.offsets.end() - 1);
+  for(int v = 0; v < n; ++v) {
+    for(const int* b = out.value_blocks.begin(v);
+        b != out.value_blocks.end(v); ++b) {
+      out.blocks.members[pos[*b]++] = v;
+    }
+  }
+  return out;
+}
+
+// Pairs of values (u, v), u < v, within radius of each other, in ascending
+// order. make_dist() returns a distance function dist(u, v) for the use of
+// one thread. Each value u is compared against the values after it that
+// share one of its blocks, once per value. Values are processed on up to
+// nthread threads, in chunks, and prog is advanced by the number of pairs
+// within the blocks (see block_pairs()) visited by each chunk, between
+// parallel regions.
+template <class DistFactory>
+inline std::vector<std::pair<int, int> >
+knn_pairs(const knn_blocking &kb, DistFactory make_dist, double radius,
+          int nthread, progress &prog = no_progress()) {
+  int n = kb.value_blocks.size();
+  int n_threads = std::max(nthread, 1);
+  // seen[t][v] is the last value that thread t compared against value v.
+  std::vector<std::vector<int> > seen(n_threads);
+  std::vector<std::pair<int, int> > out;
+  const int chunk = 4096;
+  for(int start = 0; start < n; start += chunk) {
+    int end = std::min(n, start + chunk);
+    double n_visited = 0;
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(n_threads) reduction(+:n_visited)
+#endif
+    {
+      int t = 0;
+#ifdef _OPENMP
+      t = omp_get_thread_num();
+#endif
+      std::vector<int> &last = seen[t];
+      if(last.empty()) {
+        last.assign(n, -1);
+      }
+      auto dist = make_dist();
+      std::vector<std::pair<int, int> > found;
+#ifdef _OPENMP
+      #pragma omp for schedule(dynamic, 16)
+#endif
+      for(int u = start; u < end; ++u) {
+        for(const int* b = kb.value_blocks.begin(u);
+            b != kb.value_blocks.end(u); ++b) {
+          const int* v = std::upper_bound(kb.blocks.begin(*b),
+                                          kb.blocks.end(*b), u);
+          n_visited += kb.blocks.end(*b) - v;
+          for( ; v != kb.blocks.end(*b); ++v) {
+            if(last[*v] == u) {
+              continue;
+            }
+            last[*v] = u;
+            if(dist(u, *v) <= radius) {
+              found.push_back(std::make_pair(u, *v));
+            }
+          }
+        }
+      }
+#ifdef _OPENMP
+      #pragma omp critical
+#endif
+      out.insert(out.end(), found.begin(), found.end());
+    }
+    prog.step(n_visited);
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// knn_pairs() for a distance that is computed a batch of pairs at a time,
+// e.g. by a library that runs its own threads. Candidate pairs are listed
+// on the calling thread, in the same order and once each, and passed in
+// batches to dist(pairs, out), which fills out with the distance of each
+// pair. prog is advanced by the number of pairs within the blocks visited,
+// once per batch.
+template <class BatchDistFn>
+inline std::vector<std::pair<int, int> >
+knn_pairs_batched(const knn_blocking &kb, BatchDistFn &&dist, double radius,
+                  progress &prog = no_progress()) {
+  int n = kb.value_blocks.size();
+  const size_t batch = 65536;
+  std::vector<int> last(n, -1);
+  std::vector<std::pair<int, int> > pairs;
+  std::vector<std::pair<int, int> > out;
+  std::vector<double> d;
+  double n_visited = 0;
+  auto flush = [&]() {
+    if(!pairs.empty()) {
+      dist(pairs, d);
+      for(size_t p = 0; p < pairs.size(); ++p) {
+        if(d[p] <= radius) {
+          out.push_back(pairs[p]);
+        }
+      }
+      pairs.clear();
+    }
+    prog.step(n_visited);
+    n_visited = 0;
+  };
+  for(int u = 0; u < n; ++u) {
+    for(const int* b = kb.value_blocks.begin(u);
+        b != kb.value_blocks.end(u); ++b) {
+      const int* v = std::upper_bound(kb.blocks.begin(*b), kb.blocks.end(*b),
+                                      u);
+      n_visited += kb.blocks.end(*b) - v;
+      for( ; v != kb.blocks.end(*b); ++v) {
+        if(last[*v] == u) {
+          continue;
+        }
+        last[*v] = u;
+        pairs.push_back(std::make_pair(u, *v));
+      }
+    }
+    if(pairs.size() >= batch) {
+      flush();
+    }
+  }
+  flush();
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+// Clusters of n values, given the pairs of neighbours (see knn_pairs()).
+// Each value that has neighbours forms a cluster with them. A cluster that
+// is a subset of the cluster of one of its members is dropped, as is a
+// cluster equal to that of a member with a lower index. Clusters are
+// returned in order of the value they were formed around.
+inline groups knn_clusters(int n,
+                           const std::vector<std::pair<int, int> > &pairs) {
+  // The cluster of each value: the value and its neighbours, in ascending
+  // order. Values without neighbours get an empty cluster.
+  groups clust;
+  clust.offsets.assign(n + 1, 0);
+  for(const std::pair<int, int> &p : pairs) {
+    clust.offsets[p.first + 1]++;
+    clust.offsets[p.second + 1]++;
+  }
+  for(int v = 0; v < n; ++v) {
+    if(clust.offsets[v + 1] > 0) {
+      clust.offsets[v + 1]++;
+    }
+    clust.offsets[v + 1] += clust.offsets[v];
+  }
+  clust.members.resize(clust.offsets[n]);
+  std::vector<int> pos(clust.offsets.begin(), clust.offsets.end() - 1);
+  for(int v = 0; v < n; ++v) {
+    if(clust.len(v) > 0) {
+      clust.members[pos[v]++] = v;
+    }
+  }
+  for(const std::pair<int, int> &p : pairs) {
+    clust.members[pos[p.first]++] = p.second;
+    clust.members[pos[p.second]++] = p.first;
+  }
+
+  groups out;
+  for(int v = 0; v < n; ++v) {
+    if(clust.len(v) == 0) {
+      continue;
+    }
+    std::sort(clust.members.begin() + clust.offsets[v],
+              clust.members.begin() + clust.offsets[v + 1]);
+  }
+  for(int v = 0; v < n; ++v) {
+    if(clust.len(v) == 0) {
+      continue;
+    }
+    bool dropped = false;
+    for(const int* w = clust.begin(v); w != clust.end(v) && !dropped; ++w) {
+      if(*w == v || clust.len(*w) < clust.len(v) ||
+         (clust.len(*w) == clust.len(v) && *w > v)) {
+        continue;
+      }
+      dropped = std::includes(clust.begin(*w), clust.end(*w),
+                              clust.begin(v), clust.end(v));
+    }
+    if(!dropped) {
+      out.push_back(clust.begin(v), clust.end(v));
+    }
+  }
+  return out;
+}
+
+} // namespace refinr
+
+#endif
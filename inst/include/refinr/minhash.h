@@ -0,0 +1,199 @@
+// MinHash locality sensitive hashing, used to block values for approximate
+// ngram clustering.
+//
+// Each value is summarized by a MinHash signature of bands * rows minimum
+// hashes over its set of ngrams. Values that agree on every row of at least
+// one band land in the same bucket, and only the members of a bucket are
+// compared by edit distance. Two values whose ngram sets have Jaccard
+// similarity s share a bucket with probability 1 - (1 - s^rows)^bands, so
+// more bands raise recall and more rows cut down the candidates.
+
+#ifndef REFINR_MINHASH_H
+#define REFINR_MINHASH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fingerprint.h"
+#include "groups.h"
+#include "keys.h"
+#include "progress.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace refinr {
+
+// Final mixing step of MurmurHash3, a bijection on 64 bit values.
+inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Hashes of the distinct ngrams of the normalized string norm (see
+// fingerprinter::ngram_normalize()), ngrams of numgram UTF-8 characters as
+// in fingerprinter::ngram_key(). Strings shorter than numgram characters
+// have no ngrams. starts is scratch space for char_ngrams().
+inline void ngram_hashes(std::string_view norm, int numgram,
+                         std::vector<size_t> &starts,
+                         std::vector<uint64_t> &out) {
+  out.clear();
+  char_ngrams(norm, numgram, starts, [&](std::string_view gram) {
+    out.push_back(hash_bytes(gram));
+  });
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+class minhasher {
+public:
+  minhasher(int bands, int rows) : bands(bands), rows(rows) {
+    seeds.resize(bands * rows);
+    for(int j = 0; j < bands * rows; ++j) {
+      seeds[j] = mix64(0x9e3779b97f4a7c15ULL * (j + 1));
+    }
+  }
+
+  int size() const { return bands * rows; }
+
+  // Write the signature of a set of ngram hashes to out (size() values). An
+  // empty set gets a signature of all max values.
+  void signature(const std::vector<uint64_t> &hashes, uint64_t* out) const {
+    int n = size();
+    std::fill(out, out + n, std::numeric_limits<uint64_t>::max());
+    for(uint64_t h : hashes) {
+      for(int j = 0; j < n; ++j) {
+        uint64_t x = mix64(h ^ seeds[j]);
+        if(x < out[j]) {
+          out[j] = x;
+        }
+      }
+    }
+  }
+
+  // Hash of band b of signature sig.
+  uint64_t band_hash(const uint64_t* sig, int b) const {
+    uint64_t h = mix64(seeds[b]);
+    for(int r = 0; r < rows; ++r) {
+      h = mix64(h ^ sig[b * rows + r]);
+    }
+    return h;
+  }
+
+  // Bucket n items by the bands of their signatures, sigs holding size()
+  // values per item. Items for which skip(i) is true are left out, and so
+  // are items with an empty ngram set. Returns the buckets of at least two
+  // items, with buckets holding the same items as an earlier bucket dropped.
+  // n_pairs is set to the number of candidate pairs within the buckets.
+  // prog is advanced by one step per item per band.
+  template <class Skip>
+  groups buckets(int n, const std::vector<uint64_t> &sigs, Skip skip,
+                 double &n_pairs, progress &prog = no_progress()) const {
+    groups out;
+    n_pairs = 0;
+    key_index<uint64_t, u64_hash> seen(1024);
+    std::vector<int> seen_out;
+    std::vector<int> next_out;
+    std::vector<int> ids(n);
+    std::vector<int> members;
+    const uint64_t empty = std::numeric_limits<uint64_t>::max();
+
+    for(int b = 0; b < bands; ++b) {
+      key_index<uint64_t, u64_hash> index(n);
+      for(int i = 0; i < n; ++i) {
+        const uint64_t* sig = sigs.data() + (size_t)i * size();
+        ids[i] = skip(i) || sig[0] == empty ? -1 :
+          index.insert(band_hash(sig, b));
+        prog.step();
+      }
+      groups band_groups = build_groups(ids, index.size(), 2);
+
+      // Keep the buckets that don't repeat an earlier one. Buckets are
+      // identified by a hash of their members, which is verified against the
+      // members of the earlier buckets of that hash. seen_out holds the
+      // first bucket of out of each hash, next_out the next bucket of out
+      // with the same hash, or -1.
+      for(int g = 0; g < band_groups.size(); ++g) {
+        members.assign(band_groups.begin(g), band_groups.end(g));
+        uint64_t h = hash_bytes(std::string_view(
+          (const char*)members.data(), members.size() * sizeof(int)
+        ));
+        int id = seen.insert(h);
+        int o = id < (int)seen_out.size() ? seen_out[id] : -1;
+        int last = -1;
+        for( ; o >= 0; last = o, o = next_out[o]) {
+          if((int)out.len(o) == (int)members.size() &&
+             std::equal(members.begin(), members.end(), out.begin(o))) {
+            break;
+          }
+        }
+        if(o >= 0) {
+          continue;
+        }
+        if(last >= 0) {
+          next_out[last] = out.size();
+        } else {
+          seen_out.push_back(out.size());
+        }
+        next_out.push_back(-1);
+        out.push_back(members.data(), members.data() + members.size());
+        n_pairs += (double)members.size() * (members.size() - 1) / 2;
+      }
+    }
+
+    return out;
+  }
+
+private:
+  int bands;
+  int rows;
+  std::vector<uint64_t> seeds;
+};
+
+// Compute the signatures of n strings using up to nthread threads.
+// norm(i, out) writes the normalized string of item i to out, and must be
+// safe to call from several threads at once. The items are processed in
+// chunks, and prog is advanced once per chunk, between parallel regions.
+template <class NormFn>
+inline std::vector<uint64_t> minhash_signatures(const minhasher &mh, int n,
+                                                int numgram, NormFn norm,
+                                                int nthread,
+                                                progress &prog = no_progress()) {
+  const int chunk = 16384;
+  std::vector<uint64_t> sigs((size_t)n * mh.size());
+  for(int start = 0; start < n; start += chunk) {
+    int end = std::min(n, start + chunk);
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(std::max(nthread, 1))
+#endif
+    {
+      std::vector<uint64_t> hashes;
+      std::vector<size_t> starts;
+      std::string buf;
+#ifdef _OPENMP
+      #pragma omp for schedule(dynamic, 256)
+#endif
+      for(int i = start; i < end; ++i) {
+        norm(i, buf);
+        ngram_hashes(buf, numgram, starts, hashes);
+        mh.signature(hashes, sigs.data() + (size_t)i * mh.size());
+      }
+    }
+    prog.step(end - start);
+  }
+  (void)nthread;
+  return sigs;
+}
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,140 @@
+// Sorted neighbourhood blocking, used to block values for approximate ngram
+// clustering.
+//
+// Keys are sorted under one or more orderings, and each key is compared
+// only with the next window keys of each ordering. That is about n * window
+// comparisons per ordering, however the keys are distributed. Keys within
+// the edit threshold of each other are matched, and each key forms a block
+// with the keys it matched, which is then filtered as usual (see
+// filter_block()). Blocks are not joined transitively, so no block holds
+// more than 1 + 2 * window keys per ordering, where a chain of near matches
+// would otherwise join a large share of the input into one block.
+
+#ifndef REFINR_NEIGHBOURHOOD_H
+#define REFINR_NEIGHBOURHOOD_H
+
+#include <algorithm>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "groups.h"
+#include "knn.h"
+#include "progress.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace refinr {
+
+// Orderings of n keys for the sorted neighbourhood method, one per sort
+// key. sort_keys[s](i) gives the string that key i is sorted on under
+// ordering s, and reversed[s] sorts on that string read back to front. Ties
+// keep the order of the key ids. The orderings are sorted on up to nthread
+// threads, one ordering per thread.
+template <class SortKeyFn>
+inline std::vector<std::vector<int> >
+sorted_orders(int n, const std::vector<SortKeyFn> &sort_keys,
+              const std::vector<bool> &reversed, int nthread) {
+  int n_orders = sort_keys.size();
+  std::vector<std::vector<int> > out(n_orders, std::vector<int>(n));
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(std::max(std::min(nthread, n_orders), 1))
+#endif
+  for(int s = 0; s < n_orders; ++s) {
+    std::vector<int> &order = out[s];
+    for(int i = 0; i < n; ++i) {
+      order[i] = i;
+    }
+    const SortKeyFn &key = sort_keys[s];
+    if(reversed[s]) {
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        std::string_view x = key(a);
+        std::string_view y = key(b);
+        return std::lexicographical_compare(x.rbegin(), x.rend(),
+                                            y.rbegin(), y.rend());
+      });
+    } else {
+      std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return key(a) < key(b);
+      });
+    }
+  }
+  (void)nthread;
+  return out;
+}
+
+// Number of pairs compared by neighbourhood_blocks().
+inline double window_pairs(int n, int n_orders, int window) {
+  double per_order = 0;
+  for(int i = 0; i < n; ++i) {
+    per_order += std::min(window, n - 1 - i);
+  }
+  return per_order * n_orders;
+}
+
+// Blocks of n keys under the sorted neighbourhood method. Each key is
+// compared with the next window keys of each of orders (see
+// sorted_orders()), pairs of keys being passed in batches to
+// dist(pairs, out), which fills out with the edit distance of each pair.
+// Keys at a distance below edit_threshold are matched. Each key that matched
+// forms a block with the keys it matched, blocks that are subsets of another
+// being dropped (see knn_clusters()), and each key that matched no other key
+// forms a block on its own, as a key may be shared by several values. prog
+// is advanced by the number of pairs of each batch.
+template <class BatchDistFn>
+inline groups neighbourhood_blocks(int n,
+                                   const std::vector<std::vector<int> > &orders,
+                                   int window, BatchDistFn &&dist,
+                                   double edit_threshold,
+                                   progress &prog = no_progress()) {
+  const size_t batch = 65536;
+  std::vector<std::pair<int, int> > pairs;
+  std::vector<std::pair<int, int> > matched;
+  std::vector<double> d;
+  auto flush = [&]() {
+    dist(pairs, d);
+    for(size_t p = 0; p < pairs.size(); ++p) {
+      if(d[p] < edit_threshold) {
+        matched.push_back(std::minmax(pairs[p].first, pairs[p].second));
+      }
+    }
+    prog.step(pairs.size());
+    pairs.clear();
+  };
+  for(const std::vector<int> &order : orders) {
+    for(int i = 0; i < n; ++i) {
+      int last = std::min(n - 1, i + window);
+      for(int j = i + 1; j <= last; ++j) {
+        pairs.push_back(std::make_pair(order[i], order[j]));
+      }
+      if(pairs.size() >= batch) {
+        flush();
+      }
+    }
+  }
+  if(!pairs.empty()) {
+    flush();
+  }
+
+  // The same pair can match in several orderings.
+  std::sort(matched.begin(), matched.end());
+  matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
+  groups out = knn_clusters(n, matched);
+  std::vector<bool> has_match(n, false);
+  for(const std::pair<int, int> &p : matched) {
+    has_match[p.first] = true;
+    has_match[p.second] = true;
+  }
+  for(int k = 0; k < n; ++k) {
+    if(!has_match[k]) {
+      out.push_back(&k, &k + 1);
+    }
+  }
+  return out;
+}
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,125 @@
+// Hardware performance counters, for profiling the stages of a run.
+//
+// On Linux, each event is counted with perf_event_open(2) for the calling
+// thread only, in user space only, which is what an unprivileged process may
+// count under the default perf_event_paranoid setting. Counters inherited by
+// child threads would only follow the threads started after they are opened,
+// which leaves out the OpenMP thread pools that are already running (ours and
+// those of other libraries), so the work done on other threads is not counted
+// at all rather than counted in part. Events are opened one by one rather than as
+// a group, so an event that the kernel or the hardware doesn't provide (e.g.
+// hardware events in most virtual machines and containers) is left out
+// while the others are still counted. Elsewhere, no event is available.
+
+#ifndef REFINR_PERF_H
+#define REFINR_PERF_H
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace refinr {
+
+class perf_counters {
+public:
+  // The events counted, in the order read_counts() returns them.
+  enum event {
+    cycles,
+    instructions,
+    cache_misses,
+    branch_misses,
+    page_faults,
+    n_events
+  };
+
+  // Name of event e.
+  static const char* event_name(int e) {
+    static const char* names[n_events] = {
+      "cycles", "instructions", "cache_misses", "branch_misses",
+      "page_faults"
+    };
+    return names[e];
+  }
+
+  // Open and start a counter for each event that is available.
+  perf_counters() {
+    for(int e = 0; e < n_events; ++e) {
+      fds[e] = open_event(e);
+    }
+  }
+
+  ~perf_counters() {
+#ifdef __linux__
+    for(int e = 0; e < n_events; ++e) {
+      if(fds[e] >= 0) {
+        close(fds[e]);
+      }
+    }
+#endif
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  // Is event e counted.
+  bool available(int e) const { return fds[e] >= 0; }
+
+  // Write the count of each event since the counters were opened to
+  // out[0] through out[n_events - 1], -1 for an event that isn't counted.
+  // When there are more events than hardware counters, the kernel counts
+  // them in turns, and counts are scaled up by the share of the time each
+  // event was counted.
+  void read_counts(double* out) const {
+    for(int e = 0; e < n_events; ++e) {
+      out[e] = -1;
+#ifdef __linux__
+      // The count, the time enabled and the time running.
+      uint64_t buf[3];
+      if(fds[e] < 0 || ::read(fds[e], buf, sizeof(buf)) != sizeof(buf) ||
+         buf[2] == 0) {
+        continue;
+      }
+      out[e] = (double)buf[0];
+      if(buf[2] < buf[1]) {
+        out[e] *= (double)buf[1] / buf[2];
+      }
+#endif
+    }
+  }
+
+private:
+  int fds[n_events];
+
+  static int open_event(int e) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = e == page_faults ? PERF_TYPE_SOFTWARE : PERF_TYPE_HARDWARE;
+    static const uint64_t configs[n_events] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_SW_PAGE_FAULTS
+    };
+    attr.config = configs[e];
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+      PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                        PERF_FLAG_FD_CLOEXEC);
+#else
+    (void)e;
+    return -1;
+#endif
+  }
+};
+
+} // namespace refinr
+
+#endif
@@ -0,0 +1,80 @@
+// Progress reporting and cooperative cancellation.
+//
+// Long loops of the core library advance a progress object, one stage at a
+// time. The base class reports nothing. Adapters override update() to show
+// progress, and to cancel a run by throwing from update(); the loops hold
+// their buffers in std::vector, so throwing unwinds cleanly. update() is
+// only ever called from the thread that runs the loop (never from inside a
+// parallel region).
+
+#ifndef REFINR_PROGRESS_H
+#define REFINR_PROGRESS_H
+
+#include <stdexcept>
+
+namespace refinr {
+
+// Thrown by adapters to cancel a run.
+struct cancelled : std::runtime_error {
+  cancelled() : std::runtime_error("cancelled") {}
+};
+
+class progress {
+public:
+  virtual ~progress() {}
+
+  // Start stage "name", of total items. update() is called after every
+  // "every" calls to step(), and on the step that completes the stage.
+  void stage(const char* name, double total, int every = 256) {
+    stage_name = name;
+    stage_total = total;
+    stage_done = 0;
+    stage_every = every;
+    n_steps = 0;
+    update(stage_name, stage_done, stage_total);
+  }
+
+  // Record n more items done. Steps taken once the stage is done, e.g.
+  // step(0) to poll for cancellation, are rate limited like the others.
+  void step(double n = 1) {
+    bool completes = stage_done < stage_total && stage_done + n >= stage_total;
+    stage_done += n;
+    if(++n_steps >= stage_every || completes) {
+      n_steps = 0;
+      update(stage_name, stage_done, stage_total);
+    }
+  }
+
+  // Call update() without advancing, from within a long running item.
+  void poll() {
+    update(stage_name, stage_done, stage_total);
+  }
+
+protected:
+  // Report that done of the total items of stage "name" are done. Called
+  // often, adapters should rate limit any output, and only report every
+  // call on the start of a stage and on the first call with done reaching
+  // total.
+  virtual void update(const char* name, double done, double total) {
+    (void)name;
+    (void)done;
+    (void)total;
+  }
+
+private:
+  const char* stage_name = "";
+  double stage_total = 0;
+  double stage_done = 0;
+  int stage_every = 256;
+  int n_steps = 0;
+};
+
+// Progress object that reports nothing, used when a caller passes none.
+inline progress &no_progress() {
+  thread_local progress p;
+  return p;
+}
+
+} // namespace refinr
+
+#endif
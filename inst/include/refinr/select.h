@@ -0,0 +1,96 @@
+// Selection of the representative value of a cluster.
+
+#ifndef REFINR_SELECT_H
+#define REFINR_SELECT_H
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+namespace refinr {
+
+// Given a span of distinct members, return the member with the highest
+// count. Ties are determined by the value that sorts first (byte order).
+// Members with a count of zero are skipped, returns -1 if there are none.
+// count(i) and value(i) give the count and the string value of member i.
+template <class CountFn, class ValueFn>
+inline int most_frequent(const int* first, const int* last,
+                         CountFn count, ValueFn value) {
+  int mf_idx = -1;
+  double mf_count = 0;
+  double curr_count;
+
+  for( ; first != last; ++first) {
+    curr_count = count(*first);
+    if(curr_count <= 0) {
+      continue;
+    }
+    if(curr_count > mf_count ||
+       (curr_count == mf_count &&
+        std::string_view(value(*first)) < std::string_view(value(mf_idx)))) {
+      mf_idx = *first;
+      mf_count = curr_count;
+    }
+  }
+
+  return mf_idx;
+}
+
+// Given a span of element indices whose values may repeat, return the index
+// of an element holding the value with the highest total weight, weight(i)
+// being the weight of element i (e.g. the number of times it was counted).
+// Ties are determined by the value that sorts first (byte order). value(i)
+// gives the string value of element i, and scratch is reused between calls.
+// Returns -1 for an empty span.
+template <class ValueFn, class WeightFn>
+inline int most_frequent_value(const int* first, const int* last,
+                               ValueFn value, WeightFn weight,
+                               std::vector<int> &scratch) {
+  if(first == last) {
+    return -1;
+  }
+
+  // Sort a copy of the span by value, so that equal values form runs.
+  scratch.assign(first, last);
+  std::stable_sort(scratch.begin(), scratch.end(), [&](int a, int b) {
+    return std::string_view(value(a)) < std::string_view(value(b));
+  });
+
+  // Find the heaviest run. Runs are visited in sorted order, so keeping the
+  // first heaviest run breaks ties in favor of the smallest value.
+  int mf_idx = scratch[0];
+  double mf_weight = -1;
+  double run_weight = 0;
+  size_t run_start = 0;
+  size_t n = scratch.size();
+  for(size_t i = 0; i <= n; ++i) {
+    if(i == n || std::string_view(value(scratch[i])) !=
+       std::string_view(value(scratch[run_start]))) {
+      if(run_weight > mf_weight) {
+        mf_weight = run_weight;
+        mf_idx = scratch[run_start];
+      }
+      if(i == n) {
+        break;
+      }
+      run_start = i;
+      run_weight = 0;
+    }
+    run_weight += weight(scratch[i]);
+  }
+
+  return mf_idx;
+}
+
+// Unweighted most_frequent_value(), every element having a weight of one, so
+// the value that appears most often is returned.
+template <class ValueFn>
+inline int most_frequent_value(const int* first, const int* last,
+                               ValueFn value, std::vector<int> &scratch) {
+  return most_frequent_value(first, last, value, [](int) { return 1.0; },
+                             scratch);
+}
+
+} // namespace refinr
+
+#endif
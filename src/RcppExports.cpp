@@ -10,44 +10,158 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// ngram_plan_sample
+List ngram_plan_sample(const CharacterVector& fp_univect, const IntegerVector& sample, const int& numgram, const bool& bus_suffix, const CharacterVector& ignore_strings, const double& edit_threshold, const int& bands, const int& rows, const int& max_candidates, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread);
+RcppExport SEXP _refinr_ngram_plan_sample(SEXP fp_univectSEXP, SEXP sampleSEXP, SEXP numgramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP edit_thresholdSEXP, SEXP bandsSEXP, SEXP rowsSEXP, SEXP max_candidatesSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector& >::type sample(sampleSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type edit_threshold(edit_thresholdSEXP);
+    Rcpp::traits::input_parameter< const int& >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type max_candidates(max_candidatesSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type p(pSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type bt(btSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type q(qSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type useBytes(useBytesSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type nthread(nthreadSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_plan_sample(fp_univect, sample, numgram, bus_suffix, ignore_strings, edit_threshold, bands, rows, max_candidates, method, weight, p, bt, q, useBytes, nthread));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_fingerprint_KC
+CharacterVector cpp_fingerprint_KC(const CharacterVector& vect, const bool& bus_suffix, const CharacterVector& ignore_strings);
+RcppExport SEXP _refinr_cpp_fingerprint_KC(SEXP vectSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_fingerprint_KC(vect, bus_suffix, ignore_strings));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_fingerprint_ngram
+CharacterVector cpp_fingerprint_ngram(const CharacterVector& vect, const int& numgram, const bool& bus_suffix, const CharacterVector& ignore_strings);
+RcppExport SEXP _refinr_cpp_fingerprint_ngram(SEXP vectSEXP, SEXP numgramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_fingerprint_ngram(vect, numgram, bus_suffix, ignore_strings));
+    return rcpp_result_gen;
+END_RCPP
+}
 // merge_KC_clusters
-CharacterVector merge_KC_clusters(const CharacterVector& vect, CharacterVector& keys_vect, const CharacterVector& dict, const CharacterVector& keys_dict);
-RcppExport SEXP _refinr_merge_KC_clusters(SEXP vectSEXP, SEXP keys_vectSEXP, SEXP dictSEXP, SEXP keys_dictSEXP) {
+CharacterVector merge_KC_clusters(const CharacterVector& vect, const CharacterVector& fp_univect, const CharacterVector& dict, const CharacterVector& fp_dict, const bool& bus_suffix, const CharacterVector& ignore_strings, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_merge_KC_clusters(SEXP vectSEXP, SEXP fp_univectSEXP, SEXP dictSEXP, SEXP fp_dictSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
-    Rcpp::traits::input_parameter< CharacterVector& >::type keys_vect(keys_vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type dict(dictSEXP);
-    Rcpp::traits::input_parameter< const CharacterVector& >::type keys_dict(keys_dictSEXP);
-    rcpp_result_gen = Rcpp::wrap(merge_KC_clusters(vect, keys_vect, dict, keys_dict));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_dict(fp_dictSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(merge_KC_clusters(vect, fp_univect, dict, fp_dict, bus_suffix, ignore_strings, counts, progress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// KC_shard_plan
+List KC_shard_plan(const CharacterVector& vect, const CharacterVector& fp_univect, const CharacterVector& fp_dict, const bool& bus_suffix, const CharacterVector& ignore_strings, const int& n_shards, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_KC_shard_plan(SEXP vectSEXP, SEXP fp_univectSEXP, SEXP fp_dictSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP n_shardsSEXP, SEXP countsSEXP, SEXP progressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_dict(fp_dictSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type n_shards(n_shardsSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(KC_shard_plan(vect, fp_univect, fp_dict, bus_suffix, ignore_strings, n_shards, counts, progress));
+    return rcpp_result_gen;
+END_RCPP
+}
+// knn_merge_cpp
+List knn_merge_cpp(const CharacterVector& vect, const CharacterVector& univect, const CharacterVector& fp_univect, const bool& ppm, const double& radius, const int& block_chars, const bool& bus_suffix, const CharacterVector& ignore_strings, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_knn_merge_cpp(SEXP vectSEXP, SEXP univectSEXP, SEXP fp_univectSEXP, SEXP ppmSEXP, SEXP radiusSEXP, SEXP block_charsSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP, SEXP countsSEXP, SEXP progressSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type ppm(ppmSEXP);
+    Rcpp::traits::input_parameter< const double& >::type radius(radiusSEXP);
+    Rcpp::traits::input_parameter< const int& >::type block_chars(block_charsSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type p(pSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type bt(btSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type q(qSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type useBytes(useBytesSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type nthread(nthreadSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(knn_merge_cpp(vect, univect, fp_univect, ppm, radius, block_chars, bus_suffix, ignore_strings, method, weight, p, bt, q, useBytes, nthread, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
 // ngram_merge_no_approx
-CharacterVector ngram_merge_no_approx(CharacterVector& n_gram_keys, const CharacterVector& univect, CharacterVector& vect);
-RcppExport SEXP _refinr_ngram_merge_no_approx(SEXP n_gram_keysSEXP, SEXP univectSEXP, SEXP vectSEXP) {
+CharacterVector ngram_merge_no_approx(const CharacterVector& fp_univect, const CharacterVector& univect, const CharacterVector& vect, const int& numgram, const bool& bus_suffix, const CharacterVector& ignore_strings, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_ngram_merge_no_approx(SEXP fp_univectSEXP, SEXP univectSEXP, SEXP vectSEXP, SEXP numgramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterVector& >::type n_gram_keys(n_gram_keysSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
-    Rcpp::traits::input_parameter< CharacterVector& >::type vect(vectSEXP);
-    rcpp_result_gen = Rcpp::wrap(ngram_merge_no_approx(n_gram_keys, univect, vect));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_merge_no_approx(fp_univect, univect, vect, numgram, bus_suffix, ignore_strings, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
 // ngram_merge_approx
-CharacterVector ngram_merge_approx(CharacterVector& n_gram_keys, CharacterVector& one_gram_keys, const CharacterVector& univect, CharacterVector& vect, const double& edit_threshold, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread);
-RcppExport SEXP _refinr_ngram_merge_approx(SEXP n_gram_keysSEXP, SEXP one_gram_keysSEXP, SEXP univectSEXP, SEXP vectSEXP, SEXP edit_thresholdSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP) {
+List ngram_merge_approx(const CharacterVector& fp_univect, const CharacterVector& univect, const CharacterVector& vect, const int& numgram, const bool& bus_suffix, const CharacterVector& ignore_strings, const double& edit_threshold, const double& dist_budget, const std::string& blocking, const int& bands, const int& rows, const int& window, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread, const double& time_budget, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_ngram_merge_approx(SEXP fp_univectSEXP, SEXP univectSEXP, SEXP vectSEXP, SEXP numgramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP edit_thresholdSEXP, SEXP dist_budgetSEXP, SEXP blockingSEXP, SEXP bandsSEXP, SEXP rowsSEXP, SEXP windowSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP, SEXP time_budgetSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< CharacterVector& >::type n_gram_keys(n_gram_keysSEXP);
-    Rcpp::traits::input_parameter< CharacterVector& >::type one_gram_keys(one_gram_keysSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_univect(fp_univectSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
-    Rcpp::traits::input_parameter< CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
     Rcpp::traits::input_parameter< const double& >::type edit_threshold(edit_thresholdSEXP);
+    Rcpp::traits::input_parameter< const double& >::type dist_budget(dist_budgetSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type blocking(blockingSEXP);
+    Rcpp::traits::input_parameter< const int& >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type window(windowSEXP);
     Rcpp::traits::input_parameter< const SEXP& >::type method(methodSEXP);
     Rcpp::traits::input_parameter< const SEXP& >::type weight(weightSEXP);
     Rcpp::traits::input_parameter< const SEXP& >::type p(pSEXP);
@@ -55,103 +169,171 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const SEXP& >::type q(qSEXP);
     Rcpp::traits::input_parameter< const SEXP& >::type useBytes(useBytesSEXP);
     Rcpp::traits::input_parameter< const SEXP& >::type nthread(nthreadSEXP);
-    rcpp_result_gen = Rcpp::wrap(ngram_merge_approx(n_gram_keys, one_gram_keys, univect, vect, edit_threshold, method, weight, p, bt, q, useBytes, nthread));
+    Rcpp::traits::input_parameter< const double& >::type time_budget(time_budgetSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_merge_approx(fp_univect, univect, vect, numgram, bus_suffix, ignore_strings, edit_threshold, dist_budget, blocking, bands, rows, window, method, weight, p, bt, q, useBytes, nthread, time_budget, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_get_char_ngrams
-CharacterVector cpp_get_char_ngrams(const std::vector<std::string>& vects, const int& numgram);
-RcppExport SEXP _refinr_cpp_get_char_ngrams(SEXP vectsSEXP, SEXP numgramSEXP) {
+// perf_read
+NumericVector perf_read();
+RcppExport SEXP _refinr_perf_read() {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const std::vector<std::string>& >::type vects(vectsSEXP);
-    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_get_char_ngrams(vects, numgram));
+    rcpp_result_gen = Rcpp::wrap(perf_read());
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_tolower
-CharacterVector cpp_tolower(const CharacterVector& x);
-RcppExport SEXP _refinr_cpp_tolower(SEXP xSEXP) {
+// refine_merge
+List refine_merge(const CharacterVector& vect, const CharacterVector& univect, const CharacterVector& fp_kc, const CharacterVector& fp_ngram, const CharacterVector& dict, const CharacterVector& fp_dict_kc, const CharacterVector& fp_dict_ngram, const int& numgram, const bool& bus_suffix, const CharacterVector& ignore_strings, const double& edit_threshold, const std::string& blocking, const int& bands, const int& rows, const int& window, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_refine_merge(SEXP vectSEXP, SEXP univectSEXP, SEXP fp_kcSEXP, SEXP fp_ngramSEXP, SEXP dictSEXP, SEXP fp_dict_kcSEXP, SEXP fp_dict_ngramSEXP, SEXP numgramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP edit_thresholdSEXP, SEXP blockingSEXP, SEXP bandsSEXP, SEXP rowsSEXP, SEXP windowSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< const CharacterVector& >::type x(xSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_tolower(x));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_kc(fp_kcSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_ngram(fp_ngramSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type dict(dictSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_dict_kc(fp_dict_kcSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_dict_ngram(fp_dict_ngramSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type edit_threshold(edit_thresholdSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type blocking(blockingSEXP);
+    Rcpp::traits::input_parameter< const int& >::type bands(bandsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const int& >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type p(pSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type bt(btSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type q(qSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type useBytes(useBytesSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type nthread(nthreadSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(refine_merge(vect, univect, fp_kc, fp_ngram, dict, fp_dict_kc, fp_dict_ngram, numgram, bus_suffix, ignore_strings, edit_threshold, blocking, bands, rows, window, method, weight, p, bt, q, useBytes, nthread, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_paste_list
-CharacterVector cpp_paste_list(List& input, const std::string& collapse_str);
-RcppExport SEXP _refinr_cpp_paste_list(SEXP inputSEXP, SEXP collapse_strSEXP) {
+// ngram_state_keys
+List ngram_state_keys(const CharacterVector& fp_vect, const int& numgram, const bool& unigram, const bool& bus_suffix, const CharacterVector& ignore_strings, const SEXP& progress);
+RcppExport SEXP _refinr_ngram_state_keys(SEXP fp_vectSEXP, SEXP numgramSEXP, SEXP unigramSEXP, SEXP bus_suffixSEXP, SEXP ignore_stringsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< List& >::type input(inputSEXP);
-    Rcpp::traits::input_parameter< const std::string& >::type collapse_str(collapse_strSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_paste_list(input, collapse_str));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type fp_vect(fp_vectSEXP);
+    Rcpp::traits::input_parameter< const int& >::type numgram(numgramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type unigram(unigramSEXP);
+    Rcpp::traits::input_parameter< const bool& >::type bus_suffix(bus_suffixSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type ignore_strings(ignore_stringsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_state_keys(fp_vect, numgram, unigram, bus_suffix, ignore_strings, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_list_unique
-List cpp_list_unique(List& input, const bool& sort_vals);
-RcppExport SEXP _refinr_cpp_list_unique(SEXP inputSEXP, SEXP sort_valsSEXP) {
+// merge_KC_keyed
+List merge_KC_keyed(const CharacterVector& vect, const CharacterVector& univect, const CharacterVector& keys, const CharacterVector& dict, const CharacterVector& dict_keys, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_merge_KC_keyed(SEXP vectSEXP, SEXP univectSEXP, SEXP keysSEXP, SEXP dictSEXP, SEXP dict_keysSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< List& >::type input(inputSEXP);
-    Rcpp::traits::input_parameter< const bool& >::type sort_vals(sort_valsSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_list_unique(input, sort_vals));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type keys(keysSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type dict(dictSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type dict_keys(dict_keysSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(merge_KC_keyed(vect, univect, keys, dict, dict_keys, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// remove_strings
-List remove_strings(List& input, std::vector<std::string>& removes);
-RcppExport SEXP _refinr_remove_strings(SEXP inputSEXP, SEXP removesSEXP) {
+// ngram_merge_no_approx_keyed
+List ngram_merge_no_approx_keyed(const CharacterVector& univect, const CharacterVector& vect, const CharacterVector& keys, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_ngram_merge_no_approx_keyed(SEXP univectSEXP, SEXP vectSEXP, SEXP keysSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
-    Rcpp::traits::input_parameter< List& >::type input(inputSEXP);
-    Rcpp::traits::input_parameter< std::vector<std::string>& >::type removes(removesSEXP);
-    rcpp_result_gen = Rcpp::wrap(remove_strings(input, removes));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type keys(keysSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_merge_no_approx_keyed(univect, vect, keys, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_unique
-CharacterVector cpp_unique(const CharacterVector& vect);
-RcppExport SEXP _refinr_cpp_unique(SEXP vectSEXP) {
+// ngram_merge_approx_keyed
+List ngram_merge_approx_keyed(const CharacterVector& univect, const CharacterVector& vect, const CharacterVector& keys, const CharacterVector& unigrams, const double& edit_threshold, const double& dist_budget, const SEXP& method, const SEXP& weight, const SEXP& p, const SEXP& bt, const SEXP& q, const SEXP& useBytes, const SEXP& nthread, const SEXP& blocks, const NumericVector& counts, const SEXP& progress);
+RcppExport SEXP _refinr_ngram_merge_approx_keyed(SEXP univectSEXP, SEXP vectSEXP, SEXP keysSEXP, SEXP unigramsSEXP, SEXP edit_thresholdSEXP, SEXP dist_budgetSEXP, SEXP methodSEXP, SEXP weightSEXP, SEXP pSEXP, SEXP btSEXP, SEXP qSEXP, SEXP useBytesSEXP, SEXP nthreadSEXP, SEXP blocksSEXP, SEXP countsSEXP, SEXP progressSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type univect(univectSEXP);
     Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_unique(vect));
+    Rcpp::traits::input_parameter< const CharacterVector& >::type keys(keysSEXP);
+    Rcpp::traits::input_parameter< const CharacterVector& >::type unigrams(unigramsSEXP);
+    Rcpp::traits::input_parameter< const double& >::type edit_threshold(edit_thresholdSEXP);
+    Rcpp::traits::input_parameter< const double& >::type dist_budget(dist_budgetSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type p(pSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type bt(btSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type q(qSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type useBytes(useBytesSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type nthread(nthreadSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type blocks(blocksSEXP);
+    Rcpp::traits::input_parameter< const NumericVector& >::type counts(countsSEXP);
+    Rcpp::traits::input_parameter< const SEXP& >::type progress(progressSEXP);
+    rcpp_result_gen = Rcpp::wrap(ngram_merge_approx_keyed(univect, vect, keys, unigrams, edit_threshold, dist_budget, method, weight, p, bt, q, useBytes, nthread, blocks, counts, progress));
     return rcpp_result_gen;
 END_RCPP
 }
-// cpp_trimws_left
-CharacterVector cpp_trimws_left(const CharacterVector& vect);
-RcppExport SEXP _refinr_cpp_trimws_left(SEXP vectSEXP) {
+// cpp_tolower
+CharacterVector cpp_tolower(const CharacterVector& x);
+RcppExport SEXP _refinr_cpp_tolower(SEXP xSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const CharacterVector& >::type x(xSEXP);
+    rcpp_result_gen = Rcpp::wrap(cpp_tolower(x));
+    return rcpp_result_gen;
+END_RCPP
+}
+// cpp_unique
+CharacterVector cpp_unique(const CharacterVector& vect);
+RcppExport SEXP _refinr_cpp_unique(SEXP vectSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const CharacterVector& >::type vect(vectSEXP);
-    rcpp_result_gen = Rcpp::wrap(cpp_trimws_left(vect));
+    rcpp_result_gen = Rcpp::wrap(cpp_unique(vect));
     return rcpp_result_gen;
 END_RCPP
 }
 
 static const R_CallMethodDef CallEntries[] = {
-    {"_refinr_merge_KC_clusters", (DL_FUNC) &_refinr_merge_KC_clusters, 4},
-    {"_refinr_ngram_merge_no_approx", (DL_FUNC) &_refinr_ngram_merge_no_approx, 3},
-    {"_refinr_ngram_merge_approx", (DL_FUNC) &_refinr_ngram_merge_approx, 12},
-    {"_refinr_cpp_get_char_ngrams", (DL_FUNC) &_refinr_cpp_get_char_ngrams, 2},
+    {"_refinr_ngram_plan_sample", (DL_FUNC) &_refinr_ngram_plan_sample, 16},
+    {"_refinr_cpp_fingerprint_KC", (DL_FUNC) &_refinr_cpp_fingerprint_KC, 3},
+    {"_refinr_cpp_fingerprint_ngram", (DL_FUNC) &_refinr_cpp_fingerprint_ngram, 4},
+    {"_refinr_merge_KC_clusters", (DL_FUNC) &_refinr_merge_KC_clusters, 8},
+    {"_refinr_KC_shard_plan", (DL_FUNC) &_refinr_KC_shard_plan, 8},
+    {"_refinr_knn_merge_cpp", (DL_FUNC) &_refinr_knn_merge_cpp, 17},
+    {"_refinr_ngram_merge_no_approx", (DL_FUNC) &_refinr_ngram_merge_no_approx, 8},
+    {"_refinr_ngram_merge_approx", (DL_FUNC) &_refinr_ngram_merge_approx, 22},
+    {"_refinr_perf_read", (DL_FUNC) &_refinr_perf_read, 0},
+    {"_refinr_refine_merge", (DL_FUNC) &_refinr_refine_merge, 24},
+    {"_refinr_ngram_state_keys", (DL_FUNC) &_refinr_ngram_state_keys, 6},
+    {"_refinr_merge_KC_keyed", (DL_FUNC) &_refinr_merge_KC_keyed, 7},
+    {"_refinr_ngram_merge_no_approx_keyed", (DL_FUNC) &_refinr_ngram_merge_no_approx_keyed, 5},
+    {"_refinr_ngram_merge_approx_keyed", (DL_FUNC) &_refinr_ngram_merge_approx_keyed, 16},
     {"_refinr_cpp_tolower", (DL_FUNC) &_refinr_cpp_tolower, 1},
-    {"_refinr_cpp_paste_list", (DL_FUNC) &_refinr_cpp_paste_list, 2},
-    {"_refinr_cpp_list_unique", (DL_FUNC) &_refinr_cpp_list_unique, 2},
-    {"_refinr_remove_strings", (DL_FUNC) &_refinr_remove_strings, 2},
     {"_refinr_cpp_unique", (DL_FUNC) &_refinr_cpp_unique, 1},
-    {"_refinr_cpp_trimws_left", (DL_FUNC) &_refinr_cpp_trimws_left, 1},
     {NULL, NULL, 0}
 };
 
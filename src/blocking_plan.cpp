@@ -0,0 +1,389 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Number of UTF-8 characters of s, counted as char_ngrams() does.
+static size_t n_chars(std::string_view s) {
+  size_t n = 0;
+  for(size_t i = 0; i < s.size(); i += refinr::utf8_char_len(s[i])) {
+    ++n;
+  }
+  return n;
+}
+
+// Hashes of the unigram key of the normalized string norm, then of each
+// string left by removing one character from that key, written to out.
+// Two unigram keys are at most one character apart (one added, removed or
+// swapped) if they share one of these hashes.
+static void unigram_variants(std::string_view norm, std::string &key,
+                             std::string &buf, std::vector<uint64_t> &out) {
+  out.clear();
+  if(!refinr::fingerprinter::ngram_key(norm, 1, key)) {
+    return;
+  }
+  out.push_back(refinr::hash_bytes(key));
+  for(size_t i = 0; i < key.size(); ) {
+    size_t len = refinr::utf8_char_len(key[i]);
+    buf.assign(key, 0, i);
+    buf.append(key, std::min(i + len, key.size()), std::string::npos);
+    out.push_back(refinr::hash_bytes(buf));
+    i += len;
+  }
+}
+
+// Jaccard similarity of two sorted sets of ngram hashes.
+static double jaccard(const std::vector<uint64_t> &a,
+                      const std::vector<uint64_t> &b) {
+  size_t shared = 0;
+  for(size_t x = 0, y = 0; x < a.size() && y < b.size(); ) {
+    if(a[x] < b[y]) {
+      ++x;
+    } else if(b[y] < a[x]) {
+      ++y;
+    } else {
+      ++shared;
+      ++x;
+      ++y;
+    }
+  }
+  size_t n_union = a.size() + b.size() - shared;
+  return n_union > 0 ? (double)shared / n_union : 0;
+}
+
+// Number of strings of sorted that lie strictly between a and b.
+static int n_between(const std::vector<std::string> &sorted,
+                     std::string_view a, std::string_view b) {
+  if(b < a) {
+    std::swap(a, b);
+  }
+  auto lo = std::upper_bound(sorted.begin(), sorted.end(), a);
+  auto hi = std::lower_bound(sorted.begin(), sorted.end(), b);
+  return std::max((int)(hi - lo), 0);
+}
+
+
+// Statistics of the unique values for the blocking planner of approximate
+// ngram matching (see blocking_plan.R). fp_univect holds the unique values
+// with the R steps of the ngram fingerprint method applied, and sample the
+// indices (1-based) of the sampled values.
+//
+// The distinct ngram keys of the sample are the anchors. Comparing the
+// sample with itself only finds the matches that have both keys in the
+// sample, a fraction f^2 of the matches for a sample fraction f, which on a
+// large input is most often none at all. Instead, each anchor is compared
+// under the stringdist args with the keys of the full input whose unigram
+// keys are at most one character apart from its own, and each pair of keys
+// below edit_threshold is a match, so that a fraction f of the matches are
+// found. An anchor with more than max_candidates such keys is only compared
+// with the max_candidates keys of smallest hash, a uniform sample of them,
+// and each of its matches stands in for the number of its keys, estimated
+// from the largest hash kept, over max_candidates. Matches between keys
+// whose unigram keys are further apart are only drawn from the pairs of
+// anchors, and each stands in for the keys outside the neighbourhood of its
+// anchor over the anchors outside it. They are few, so the recalls lean on
+// the matches of the neighbourhoods, which favours unigram blocking.
+//
+// For each match, records whether its keys share a unigram key (unigram
+// blocking), the Jaccard similarity of their ngram sets (minhash blocking),
+// the smallest number of anchors that sort between its keys in the three
+// sort orders of sorted blocking, and its weight.
+// Returns a list holding the number of anchors, their mean length in
+// characters, the number of values of the full input of each unigram key,
+// the expected number of pairs of anchors that share a minhash bucket under
+// bands and rows, and the data of each match.
+// [[Rcpp::export]]
+List ngram_plan_sample(const CharacterVector &fp_univect,
+                       const IntegerVector &sample,
+                       const int &numgram,
+                       const bool &bus_suffix,
+                       const CharacterVector &ignore_strings,
+                       const double &edit_threshold,
+                       const int &bands,
+                       const int &rows,
+                       const int &max_candidates,
+                       const SEXP &method,
+                       const SEXP &weight,
+                       const SEXP &p,
+                       const SEXP &bt,
+                       const SEXP &q,
+                       const SEXP &useBytes,
+                       const SEXP &nthread) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  int univect_len = fp_univect.size();
+  int sample_len = sample.size();
+  r_progress prog(R_NilValue);
+
+  // Key the sample for both orders, as ngram_approx_clusters() does.
+  refinr::string_arena norms;
+  std::vector<std::vector<int> > ids;
+  std::vector<int> n_ids = refinr::ngram_key_ids(
+    fp, sample_len,
+    [&](int i) { return char_view(STRING_ELT(fp_univect, sample[i] - 1)); },
+    {numgram, 1}, norms, ids
+  );
+  const std::vector<int> &key_ids = ids[0];
+  int n_keys = n_ids[0];
+  refinr_groups key_groups = refinr::build_groups(key_ids, n_keys, 1);
+
+  // Key strings, ngram sets, unigram variants and sort keys of each anchor,
+  // cut from the normalized string of its first value. The sort keys of the
+  // reversed order are the keys read back to front.
+  CharacterVector key_strs(n_keys);
+  refinr::string_arena keys;
+  std::vector<uint64_t> key_hashes(n_keys);
+  std::vector<std::vector<uint64_t> > grams(n_keys);
+  std::vector<uint64_t> key_unigrams(n_keys);
+  std::vector<std::vector<std::string> > sort_keys(3);
+  refinr::key_index<uint64_t, refinr::u64_hash> variant_index(n_keys * 8);
+  std::vector<std::vector<int> > variant_anchors;
+  std::vector<std::vector<int> > anchor_variants(n_keys);
+  std::vector<uint64_t> variants;
+  std::vector<size_t> starts;
+  std::string key;
+  std::string unigram_key;
+  std::string buf;
+  double key_chars = 0;
+  for(int k = 0; k < n_keys; ++k) {
+    std::string_view norm = norms[*key_groups.begin(k)];
+    refinr::fingerprinter::ngram_key(norm, numgram, key);
+    keys.push(key);
+    key_hashes[k] = refinr::hash_bytes(key);
+    SET_STRING_ELT(key_strs, k,
+                   Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8));
+    refinr::ngram_hashes(norm, numgram, starts, grams[k]);
+    // A key is its distinct ngrams pasted together.
+    key_chars += (double)numgram * grams[k].size();
+
+    unigram_variants(norm, unigram_key, buf, variants);
+    key_unigrams[k] = variants[0];
+    for(uint64_t h : variants) {
+      int id = variant_index.insert(h);
+      if(id == (int)variant_anchors.size()) {
+        variant_anchors.emplace_back();
+      }
+      variant_anchors[id].push_back(k);
+      anchor_variants[k].push_back(id);
+    }
+
+    sort_keys[0].emplace_back(key);
+    sort_keys[1].emplace_back(key.rbegin(), key.rend());
+    sort_keys[2].emplace_back(norm);
+  }
+  for(std::vector<std::string> &order : sort_keys) {
+    std::sort(order.begin(), order.end());
+  }
+
+  // Anchors in the unigram neighbourhood of each anchor, sorted.
+  std::vector<std::vector<int> > neighbours(n_keys);
+  for(int k = 0; k < n_keys; ++k) {
+    std::vector<int> &nb = neighbours[k];
+    for(int id : anchor_variants[k]) {
+      nb.insert(nb.end(), variant_anchors[id].begin(),
+                variant_anchors[id].end());
+    }
+    std::sort(nb.begin(), nb.end());
+    nb.erase(std::unique(nb.begin(), nb.end()), nb.end());
+    nb.erase(std::lower_bound(nb.begin(), nb.end(), k));
+  }
+
+  // Expected number of pairs of anchors that share a minhash bucket.
+  double minhash_pairs = 0;
+  for(int i = 0; i < n_keys; ++i) {
+    for(int j = i + 1; j < n_keys; ++j) {
+      minhash_pairs += 1 - std::pow(
+        1 - std::pow(jaccard(grams[i], grams[j]), rows), bands
+      );
+    }
+  }
+
+  // Scan the full input: count the values of each unigram key, and keep the
+  // candidates of each anchor as a max heap of (key hash, value). Values
+  // that share a key share a unigram key, so each key is only looked up
+  // once, and its unigram key is kept for the values that follow.
+  typedef std::pair<uint64_t, int> candidate;
+  std::vector<std::vector<candidate> > candidates(n_keys);
+  std::vector<bool> capped(n_keys, false);
+  refinr::key_index<uint64_t, refinr::u64_hash> seen_keys(1024);
+  std::vector<int> seen_unigrams;
+  refinr::key_index<uint64_t, refinr::u64_hash> unigram_index(1024);
+  std::vector<int> unigram_sizes;
+  std::vector<int> hits;
+  std::string norm;
+  size_t min_chars = std::max(numgram, 1);
+  size_t cap = std::max(max_candidates, 1);
+  prog.stage("plan", univect_len);
+  for(int v = 0; v < univect_len; ++v) {
+    prog.step();
+    fp.ngram_normalize(char_view(STRING_ELT(fp_univect, v)), norm);
+    if(n_chars(norm) < min_chars) {
+      continue;
+    }
+    refinr::fingerprinter::ngram_key(norm, numgram, key);
+    uint64_t h = refinr::hash_bytes(key);
+    int seen = seen_keys.insert(h);
+    if(seen < (int)seen_unigrams.size()) {
+      unigram_sizes[seen_unigrams[seen]]++;
+      continue;
+    }
+    unigram_variants(norm, unigram_key, buf, variants);
+    int u = unigram_index.insert(variants[0]);
+    if(u == (int)unigram_sizes.size()) {
+      unigram_sizes.push_back(0);
+    }
+    unigram_sizes[u]++;
+    seen_unigrams.push_back(u);
+
+    hits.clear();
+    for(uint64_t x : variants) {
+      int id = variant_index.find(x);
+      if(id >= 0) {
+        hits.insert(hits.end(), variant_anchors[id].begin(),
+                    variant_anchors[id].end());
+      }
+    }
+    std::sort(hits.begin(), hits.end());
+    hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+    for(int a : hits) {
+      if(h == key_hashes[a] && keys[a] == key) {
+        continue;
+      }
+      std::vector<candidate> &c = candidates[a];
+      if(c.size() < cap) {
+        c.push_back(candidate(h, v));
+        std::push_heap(c.begin(), c.end());
+      } else if(h < c.front().first) {
+        std::pop_heap(c.begin(), c.end());
+        c.back() = candidate(h, v);
+        std::push_heap(c.begin(), c.end());
+        capped[a] = true;
+      }
+    }
+  }
+
+  // Weight of the matches of each anchor. The hashes are uniform over 2^64,
+  // so the largest of the cap smallest hashes estimates the number of keys
+  // of a capped anchor as (cap - 1) / (largest / 2^64).
+  std::vector<double> anchor_weights(n_keys, 1);
+  for(int a = 0; a < n_keys; ++a) {
+    if(capped[a] && cap > 1) {
+      double largest = std::ldexp((double)candidates[a].front().first, -64);
+      anchor_weights[a] = (cap - 1) / largest / cap;
+    }
+  }
+
+  // Compare each anchor with its candidates, in batches.
+  std::vector<std::pair<int, int> > pairs;
+  for(int a = 0; a < n_keys; ++a) {
+    for(const candidate &c : candidates[a]) {
+      pairs.push_back(std::make_pair(a, c.second));
+    }
+  }
+  std::vector<bool> match_unigram;
+  std::vector<double> match_jaccard;
+  std::vector<int> match_between;
+  std::vector<double> match_weight;
+  const size_t batch_size = 65536;
+  CharacterVector a_strs;
+  CharacterVector b_strs;
+  refinr::string_arena batch_norms;
+  std::vector<uint64_t> b_grams;
+  for(size_t start = 0; start < pairs.size(); start += batch_size) {
+    int n = std::min(batch_size, pairs.size() - start);
+    if(a_strs.size() != n) {
+      a_strs = CharacterVector(n);
+      b_strs = CharacterVector(n);
+    }
+    batch_norms.reset();
+    for(int i = 0; i < n; ++i) {
+      const std::pair<int, int> &pr = pairs[start + i];
+      fp.ngram_normalize(char_view(STRING_ELT(fp_univect, pr.second)), norm);
+      batch_norms.push(norm);
+      refinr::fingerprinter::ngram_key(norm, numgram, key);
+      SET_STRING_ELT(a_strs, i, STRING_ELT(key_strs, pr.first));
+      SET_STRING_ELT(b_strs, i,
+                     Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8));
+    }
+    NumericVector dist = stringdist_elementwise(a_strs, b_strs, method,
+                                                weight, p, bt, q, useBytes,
+                                                nthread);
+    for(int i = 0; i < n; ++i) {
+      if(!(dist[i] < edit_threshold)) {
+        continue;
+      }
+      int a = pairs[start + i].first;
+      std::string_view b_norm = batch_norms[i];
+      std::string_view b_key = char_view(STRING_ELT(b_strs, i));
+      unigram_variants(b_norm, unigram_key, buf, variants);
+      refinr::ngram_hashes(b_norm, numgram, starts, b_grams);
+      key.assign(b_key.rbegin(), b_key.rend());
+      std::string_view a_key = keys[a];
+      std::string a_rev(a_key.rbegin(), a_key.rend());
+      int between = std::min({
+        n_between(sort_keys[0], a_key, b_key),
+        n_between(sort_keys[1], a_rev, key),
+        n_between(sort_keys[2], norms[*key_groups.begin(a)], b_norm)
+      });
+      match_unigram.push_back(variants[0] == key_unigrams[a]);
+      match_jaccard.push_back(jaccard(grams[a], b_grams));
+      match_between.push_back(between);
+      match_weight.push_back(anchor_weights[a]);
+    }
+  }
+
+  // Matches outside the unigram neighbourhoods, from the pairs of anchors.
+  // Each is counted once for each of its anchors, and stands in for the
+  // keys of the full input outside the neighbourhood of that anchor over
+  // the anchors outside it.
+  std::vector<double> outside_weights(n_keys, 0);
+  double n_seen = seen_keys.size();
+  for(int a = 0; a < n_keys; ++a) {
+    double inside = anchor_weights[a] * candidates[a].size();
+    double sampled = n_keys - 1 - (double)neighbours[a].size();
+    if(sampled > 0) {
+      outside_weights[a] = std::max(n_seen - 1 - inside, 0.0) / sampled;
+    }
+  }
+  NumericVector lower_tri;
+  if(n_keys > 1) {
+    lower_tri = stringdist_lower_tri(key_strs, method, weight, p, bt, q,
+                                     useBytes, nthread);
+  }
+  R_xlen_t idx = 0;
+  for(int i = 0; i < n_keys; ++i) {
+    for(int j = i + 1; j < n_keys; ++j, ++idx) {
+      if(!(lower_tri[idx] < edit_threshold) ||
+         std::binary_search(neighbours[i].begin(), neighbours[i].end(), j)) {
+        continue;
+      }
+      std::string_view a_key = keys[i];
+      std::string_view b_key = keys[j];
+      std::string a_rev(a_key.rbegin(), a_key.rend());
+      key.assign(b_key.rbegin(), b_key.rend());
+      int between = std::min({
+        n_between(sort_keys[0], a_key, b_key),
+        n_between(sort_keys[1], a_rev, key),
+        n_between(sort_keys[2], norms[*key_groups.begin(i)],
+                  norms[*key_groups.begin(j)])
+      });
+      double similarity = jaccard(grams[i], grams[j]);
+      for(int a : {i, j}) {
+        match_unigram.push_back(false);
+        match_jaccard.push_back(similarity);
+        match_between.push_back(between);
+        match_weight.push_back(outside_weights[a]);
+      }
+    }
+  }
+
+  return List::create(
+    _["n_keys"] = n_keys,
+    _["key_chars"] = n_keys > 0 ? key_chars / n_keys : 0,
+    _["unigram_sizes"] = wrap(unigram_sizes),
+    _["minhash_pairs"] = minhash_pairs,
+    _["match_unigram"] = wrap(match_unigram),
+    _["match_jaccard"] = wrap(match_jaccard),
+    _["match_between"] = wrap(match_between),
+    _["match_weight"] = wrap(match_weight)
+  );
+}
@@ -0,0 +1,107 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Adapters between R character vectors and the fingerprint functions of the
+// core library (refinr/fingerprint.h).
+
+
+// Build a fingerprinter from the R args. NA values of ignore_strings are
+// dropped.
+refinr::fingerprinter make_fingerprinter(const bool &bus_suffix,
+                                         const CharacterVector &ignore_strings) {
+  std::vector<std::string> ignores;
+  for(int i = 0; i < ignore_strings.size(); ++i) {
+    if(!CharacterVector::is_na(ignore_strings[i])) {
+      ignores.push_back(std::string(CHAR(STRING_ELT(ignore_strings, i))));
+    }
+  }
+  return refinr::fingerprinter(bus_suffix, ignores);
+}
+
+
+// Get the key collision fingerprint of each element of vect. NA values, and
+// values that have no tokens left after normalization, get an NA key.
+// [[Rcpp::export]]
+CharacterVector cpp_fingerprint_KC(const CharacterVector &vect,
+                                   const bool &bus_suffix,
+                                   const CharacterVector &ignore_strings) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  int vect_len = vect.size();
+  CharacterVector out(vect_len);
+  std::string key;
+  SEXP x;
+
+  for(int i = 0; i < vect_len; ++i) {
+    x = STRING_ELT(vect, i);
+    if(x != NA_STRING && fp.key_collision(char_view(x), key)) {
+      SET_STRING_ELT(out, i, Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8));
+    } else {
+      SET_STRING_ELT(out, i, NA_STRING);
+    }
+  }
+
+  return out;
+}
+
+
+// Get the ngram fingerprint of each element of vect. NA values, and values
+// that are shorter than numgram after normalization, get an NA key.
+// [[Rcpp::export]]
+CharacterVector cpp_fingerprint_ngram(const CharacterVector &vect,
+                                      const int &numgram,
+                                      const bool &bus_suffix,
+                                      const CharacterVector &ignore_strings) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  int vect_len = vect.size();
+  CharacterVector out(vect_len);
+  std::string key;
+  SEXP x;
+
+  for(int i = 0; i < vect_len; ++i) {
+    x = STRING_ELT(vect, i);
+    if(x != NA_STRING && fp.ngram(char_view(x), numgram, key)) {
+      SET_STRING_ELT(out, i, Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8));
+    } else {
+      SET_STRING_ELT(out, i, NA_STRING);
+    }
+  }
+
+  return out;
+}
+
+
+// Write the fingerprint key of CHARSXP x to out, a numgram of zero meaning
+// the key collision fingerprint. Returns false if x has no key.
+bool fingerprint_key(const refinr::fingerprinter &fp,
+                     const int &numgram,
+                     SEXP x,
+                     std::string &out) {
+  if(x == NA_STRING) {
+    return false;
+  }
+  if(numgram == 0) {
+    return fp.key_collision(char_view(x), out);
+  }
+  return fp.ngram(char_view(x), numgram, out);
+}
+
+
+// Get the id of the fingerprint key of each element of vect, grouping on 64
+// bit hashes of the keys rather than on key strings (see refinr/keys.h).
+// Elements without a key get id -1. Returns the number of distinct keys.
+// prog is advanced by one step per element.
+int fingerprint_key_ids(const CharacterVector &vect,
+                        const refinr::fingerprinter &fp,
+                        const int &numgram,
+                        std::vector<int> &ids,
+                        refinr::progress &prog) {
+  return refinr::hashed_key_ids(
+    vect.size(),
+    [&](int i, std::string &out) {
+      return fingerprint_key(fp, numgram, STRING_ELT(vect, i), out);
+    },
+    ids, prog
+  );
+}
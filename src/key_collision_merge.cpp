@@ -4,72 +4,231 @@ using namespace Rcpp;
 
 
 // Wrapper for the two KC merge functions (one with a data dict, one without).
+// fp_univect and fp_dict are the distinct values of vect (in order of first
+// appearance, see cpp_unique()) and dict with the R steps of the fingerprint
+// method applied (see get_fingerprint.R), their keys are computed here.
+// counts holds the number of times each element of vect was counted, or is
+// empty if each element counts once. progress is an R callback for progress
+// reports, or NULL (see progress.cpp).
 // [[Rcpp::export]]
 CharacterVector merge_KC_clusters(const CharacterVector &vect,
-                                  CharacterVector &keys_vect,
+                                  const CharacterVector &fp_univect,
                                   const CharacterVector &dict,
-                                  const CharacterVector &keys_dict) {
-  if(CharacterVector::is_na(dict[0])) {
-    // If dict is NA, get vector of all key values that have at least one
-    // duplicate within keys (this creates clusters). The "merge_" func will
-    // make mass edits to the values of vect related to that cluster.
-    CharacterVector clusters = cpp_get_key_dups(keys_vect);
-    return merge_KC_clusters_no_dict(clusters, vect, keys_vect);
+                                  const CharacterVector &fp_dict,
+                                  const bool &bus_suffix,
+                                  const CharacterVector &ignore_strings,
+                                  const NumericVector &counts,
+                                  const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+  bool has_dict = !CharacterVector::is_na(dict[0]);
+
+  // Group the indices of vect (and dict) by key, only keeping keys that have
+  // at least one duplicate (this creates clusters). If vect is an ALTREP
+  // vector, value_index keeps its distinct values alive until the merge is
+  // done (see refinr_index).
+  refinr_index value_index(vect.size(), ALTREP(vect));
+  std::vector<int> ids;
+  int n_keys = KC_key_ids(vect, fp_univect,
+                          has_dict ? fp_dict : CharacterVector(0), fp,
+                          value_index, ids, prog);
+  refinr_groups clusters = refinr::build_groups(ids, n_keys, 2);
+
+  prog.stage("merge", clusters.size());
+  if(has_dict) {
+    return merge_KC_clusters_dict(vect, dict, clusters, counts, prog);
   } else {
-    // If dict is not NA, get all key_vect values that have:
-    // 1. At least one duplicate within key_vect, AND/OR
-    // 2. At least one matching value within key_dict.
-    // The "merge_" func will make mass edits to the values of vect related to
-    // that cluster.
-    CharacterVector both_keys(keys_vect.size() + keys_dict.size());
-    int i = 0;
-    for( ; i < keys_vect.size(); i++) both_keys[i] = keys_vect[i];
-    for(int j = 0; j < keys_dict.size(); i++, j++) both_keys[i] = keys_dict[j];
-    CharacterVector clusters = cpp_get_key_dups(both_keys);
-    return merge_KC_clusters_dict(clusters, vect, keys_vect, dict, keys_dict);
+    return merge_KC_clusters_no_dict(vect, clusters, counts, prog);
+  }
+}
+
+
+// Get the key id of each element of vect, followed by the key id of each
+// element of fp_dict. Keys are hashed key collision fingerprints (see
+// refinr/keys.h) of the elements of fp_univect, one per distinct value of
+// vect. Elements without a key get id -1. Returns the number of distinct
+// keys. The distinct values of vect are indexed in value_index. Reports the
+// "index" and "fingerprint" stages to prog.
+int KC_key_ids(const CharacterVector &vect,
+               const CharacterVector &fp_univect,
+               const CharacterVector &fp_dict,
+               const refinr::fingerprinter &fp,
+               refinr_index &value_index,
+               std::vector<int> &ids,
+               refinr::progress &prog) {
+  int vect_len = vect.size();
+  int dict_len = fp_dict.size();
+  std::vector<int> value_ids;
+  std::vector<int> first;
+  std::vector<int> distinct_ids;
+  int n_keys = KC_value_key_ids(vect, fp_univect, fp_dict, fp, value_index,
+                                value_ids, first, distinct_ids, prog);
+  int n_values = first.size();
+
+  ids.resize(vect_len + dict_len);
+  for(int i = 0; i < vect_len; ++i) {
+    ids[i] = value_ids[i] < 0 ? -1 : distinct_ids[value_ids[i]];
+  }
+  for(int i = 0; i < dict_len; ++i) {
+    ids[vect_len + i] = distinct_ids[n_values + i];
+  }
+
+  return n_keys;
+}
+
+
+// Get the id of the distinct value of each element of vect into value_ids
+// (-1 for NA), indexing the distinct values in value_index, and the first
+// index of each distinct value into first. Distinct values are numbered in
+// order of first appearance, so value id i is element i of fp_univect. Then
+// get the key id of each distinct value, followed by the key id of each
+// element of fp_dict, into key_ids (-1 for no key). Returns the number of
+// distinct keys. Reports the "index" and "fingerprint" stages to prog.
+int KC_value_key_ids(const CharacterVector &vect,
+                     const CharacterVector &fp_univect,
+                     const CharacterVector &fp_dict,
+                     const refinr::fingerprinter &fp,
+                     refinr_index &value_index,
+                     std::vector<int> &value_ids,
+                     std::vector<int> &first,
+                     std::vector<int> &key_ids,
+                     refinr::progress &prog) {
+  int vect_len = vect.size();
+  int dict_len = fp_dict.size();
+
+  // Get the distinct values of vect, and the first index of each.
+  value_ids.clear();
+  value_ids.reserve(vect_len);
+  prog.stage("index", vect_len);
+  int n_values = assign_group_ids(vect, value_index, value_ids, prog);
+  first.assign(n_values, -1);
+  for(int i = 0; i < vect_len; ++i) {
+    if(value_ids[i] >= 0 && first[value_ids[i]] < 0) {
+      first[value_ids[i]] = i;
+    }
+  }
+
+  // Key the distinct values of vect, followed by the values of dict.
+  prog.stage("fingerprint", n_values + dict_len);
+  return refinr::hashed_key_ids(
+    n_values + dict_len,
+    [&](int i, std::string &out) {
+      SEXP x = i < n_values ? STRING_ELT(fp_univect, i) :
+        STRING_ELT(fp_dict, i - n_values);
+      return fingerprint_key(fp, 0, x, out);
+    },
+    key_ids, prog
+  );
+}
+
+
+// Partition the distinct values of vect, and the values of dict, into
+// n_shards shards for sharded key collision merging (see shards.R). Values
+// are assigned to shards by key id, so all values sharing a key land in the
+// same shard, and each shard can be merged on its own. Values without a key
+// are in no shard. counts holds the number of times each element of vect was
+// counted, or is empty if each element counts once.
+// Returns a list holding the distinct value of each element of vect, the
+// first index of each distinct value, the total count of each distinct
+// value, and the shard of each distinct value and of each value of dict
+// (all 1-based, NA for none).
+// [[Rcpp::export]]
+List KC_shard_plan(const CharacterVector &vect,
+                   const CharacterVector &fp_univect,
+                   const CharacterVector &fp_dict,
+                   const bool &bus_suffix,
+                   const CharacterVector &ignore_strings,
+                   const int &n_shards,
+                   const NumericVector &counts,
+                   const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+  int vect_len = vect.size();
+  int dict_len = fp_dict.size();
+
+  std::vector<int> value_ids;
+  std::vector<int> first;
+  std::vector<int> key_ids;
+  refinr_index value_index(vect_len, ALTREP(vect));
+  KC_value_key_ids(vect, fp_univect, fp_dict, fp, value_index, value_ids,
+                   first, key_ids, prog);
+  int n_values = first.size();
+
+  IntegerVector out_value_ids(vect_len);
+  NumericVector out_counts(n_values);
+  bool weighted = counts.size() > 0;
+  for(int i = 0; i < vect_len; ++i) {
+    if(value_ids[i] < 0) {
+      out_value_ids[i] = NA_INTEGER;
+      continue;
+    }
+    out_value_ids[i] = value_ids[i] + 1;
+    out_counts[value_ids[i]] += weighted ? (double)counts[i] : 1.0;
+  }
+
+  // Key ids are numbered densely, so dealing them out in turn balances the
+  // number of keys per shard.
+  auto shard = [&](int key_id) {
+    return key_id < 0 ? NA_INTEGER : key_id % n_shards + 1;
+  };
+  IntegerVector out_first(n_values);
+  IntegerVector value_shards(n_values);
+  for(int v = 0; v < n_values; ++v) {
+    out_first[v] = first[v] + 1;
+    value_shards[v] = shard(key_ids[v]);
+  }
+  IntegerVector dict_shards(dict_len);
+  for(int i = 0; i < dict_len; ++i) {
+    dict_shards[i] = shard(key_ids[n_values + i]);
   }
+
+  return List::create(_["value_ids"] = out_value_ids,
+                      _["first"] = out_first,
+                      _["counts"] = out_counts,
+                      _["value_shards"] = value_shards,
+                      _["dict_shards"] = dict_shards);
 }
 
 
 // Merge key collision clusters of similar values, when no reference dict was
-// passed to func "key_collision_merge".
-CharacterVector merge_KC_clusters_no_dict(const CharacterVector &clusters,
-                                          const CharacterVector &vect,
-                                          CharacterVector &keys_vect) {
+// passed to func "key_collision_merge". Each cluster span of obj "clusters"
+// holds indices of vect. The most frequent value of a cluster is weighted by
+// counts, unless counts is empty. prog is advanced by one step per cluster.
+CharacterVector merge_KC_clusters_no_dict(const CharacterVector &vect,
+                                          const refinr_groups &clusters,
+                                          const NumericVector &counts,
+                                          refinr::progress &prog) {
   // Create copy of vect to use as the output vector.
-  CharacterVector output = clone(vect);
-
-  // Create unordered_map, using clusters as keys, values will be the indices
-  // of each cluster in keys_vect.
-  refinr_map keys_vect_map = create_map(keys_vect, clusters);
+  CharacterVector output = copy_strings(vect);
+  int clusters_len = clusters.size();
 
   // Initialize variables used in the loop below.
-  std::vector<int> curr_idx;
+  auto value = [&](int i) { return char_view(STRING_ELT(vect, i)); };
+  bool weighted = counts.size() > 0;
+  auto weight = [&](int i) -> double {
+    return weighted ? (double)counts[i] : 1.0;
+  };
+  std::vector<int> scratch;
+  const int* curr_idx;
   int curr_idx_len;
-  freq_string mfs;
-
-  // refinr_map uses pointers to CHARSXP SEXP as keys. Get pointers to the
-  // SEXP clusters, to iterate over in the loop below.
-  SEXP* ptr = get_string_ptr(clusters);
+  SEXP mf_str;
 
   // Iterate over clusters, make mass edits to output.
-  for(unsigned int j = 0; j < clusters.size(); ++j) {
-    // Create subset of vect using the indices from keys_vect_map that
-    // correspond to the current cluster iteration.
-    curr_idx = keys_vect_map[ptr[j]];
-    curr_idx_len = curr_idx.size();
-    CharacterVector curr_vect(curr_idx_len);
-    for(int i = 0; i < curr_idx_len; ++i) {
-      curr_vect[i] = vect[curr_idx[i]];
-    }
+  for(int j = 0; j < clusters_len; ++j) {
+    curr_idx = clusters.begin(j);
+    curr_idx_len = clusters.len(j);
 
-    // Get the string that appears most often in curr_vect.
-    most_freq_str(curr_vect, mfs);
+    // Get the string that appears most often within the cluster.
+    mf_str = STRING_ELT(
+      vect, refinr::most_frequent_value(curr_idx, curr_idx + curr_idx_len,
+                                        value, weight, scratch)
+    );
 
     // For each index in curr_idx, edit output to be equal to most_freq_string.
     for(int n = 0; n < curr_idx_len; ++n) {
-      output[curr_idx[n]] = mfs.mf_str;
+      SET_STRING_ELT(output, curr_idx[n], mf_str);
     }
+    prog.step();
   }
 
   return output;
@@ -77,73 +236,77 @@ CharacterVector merge_KC_clusters_no_dict(const CharacterVector &clusters,
 
 
 // Merge key collision clusters of similar values, when a reference dict was
-// passed to func "key_collision_merge".
-CharacterVector merge_KC_clusters_dict(const CharacterVector &clusters,
-                                       const CharacterVector &vect,
-                                       CharacterVector &keys_vect,
+// passed to func "key_collision_merge". Each cluster span of obj "clusters"
+// holds indices of vect, and indices of dict offset by the length of vect.
+// Only clusters that have:
+// 1. At least one duplicate within vect, AND/OR
+// 2. At least one matching value within dict
+// are passed in. The most frequent value of a cluster without dict values is
+// weighted by counts, unless counts is empty. prog is advanced by one step
+// per cluster.
+CharacterVector merge_KC_clusters_dict(const CharacterVector &vect,
                                        const CharacterVector &dict,
-                                       const CharacterVector &keys_dict) {
+                                       const refinr_groups &clusters,
+                                       const NumericVector &counts,
+                                       refinr::progress &prog) {
   // Create copy of vect to use as the output vector.
-  CharacterVector output = clone(vect);
-
-  // Create two unordered_maps, both using clusters as keys. Values for
-  // Values for keys_vect_map will be the indices of each cluster in keys_vect.
-  // Values for keys_dict_map will be the indices of each cluster in keys_dict.
-  refinr_map keys_vect_map = create_map(keys_vect, clusters);
-  refinr_map keys_dict_map = create_map(keys_dict, clusters);
+  CharacterVector output = copy_strings(vect);
+  int clusters_len = clusters.size();
+  int vect_len = vect.size();
 
-  // Initialize variables used in the loop below.
-  std::vector<int> curr_vect_idx;
+  // Initialize variables used in the loop below. value(i) gets the string of
+  // cluster index i, from either vect or dict.
+  auto value = [&](int i) {
+    return i < vect_len ? char_view(STRING_ELT(vect, i)) :
+      char_view(STRING_ELT(dict, i - vect_len));
+  };
+  bool weighted = counts.size() > 0;
+  auto weight = [&](int i) -> double {
+    return weighted ? (double)counts[i] : 1.0;
+  };
+  std::vector<int> scratch;
+  const int* curr_idx;
+  int curr_idx_len;
   int curr_vect_len;
-  std::vector<int> curr_dict_idx;
   int curr_dict_len;
-  bool not_in_dict;
-  freq_string mfs;
-
-  // refinr_map uses pointers to CHARSXP SEXP as keys. Get pointers to the
-  // SEXP clusters, to iterate over in the loop below.
-  SEXP* ptr = get_string_ptr(clusters);
+  SEXP mf_str;
 
   // Iterate over clusters, make mass edits to output.
-  for(unsigned int j = 0; j < clusters.size(); ++j) {
-    // Create subset of vect using the indices that correspond to curr_clust.
-    curr_vect_idx = keys_vect_map[ptr[j]];
-    curr_vect_len = curr_vect_idx.size();
-    CharacterVector curr_vect(curr_vect_len);
-    for(int i = 0; i < curr_vect_len; ++i) {
-      curr_vect[i] = vect[curr_vect_idx[i]];
-    }
+  for(int j = 0; j < clusters_len; ++j) {
+    // Indices within each span are sorted, so the indices into vect come
+    // first, followed by the indices into dict.
+    curr_idx = clusters.begin(j);
+    curr_idx_len = clusters.len(j);
+    curr_vect_len = std::lower_bound(curr_idx, curr_idx + curr_idx_len,
+                                     vect_len) - curr_idx;
+    curr_dict_len = curr_idx_len - curr_vect_len;
+    prog.step();
 
-    // Check to see if curr_clust appears in keys_dict_map. If it does, create
-    // subset of dict using the indices that correspond to curr_clust.
-    curr_dict_idx = keys_dict_map[ptr[j]];
-    curr_dict_len = curr_dict_idx.size();
-    CharacterVector curr_dict(curr_dict_len);
-    not_in_dict = true;
-    if(curr_dict_len > 0) {
-      not_in_dict = false;
-      for(int i = 0; i < curr_dict_len; ++i) {
-        curr_dict[i] = dict[curr_dict_idx[i]];
-      }
+    // If the cluster only contains dict values, there's nothing to edit.
+    if(curr_vect_len == 0) {
+      continue;
     }
 
-    // Establish most_freq_string. If curr_clust exists in curr_dict, get
-    // most_freq_string from curr_dict. Otherwise get most_freq_string from
-    // curr_vect.
-    if(not_in_dict) {
-      most_freq_str(curr_vect, mfs);
+    // Establish most_freq_string. If curr_clust exists in dict, get
+    // most_freq_string from the dict subset. Otherwise get most_freq_string
+    // from the vect subset.
+    if(curr_dict_len == 0) {
+      mf_str = STRING_ELT(
+        vect, refinr::most_frequent_value(curr_idx, curr_idx + curr_vect_len,
+                                          value, weight, scratch)
+      );
     } else {
-      if(curr_dict_len == 1) {
-        mfs.mf_str = curr_dict[0];
-      } else {
-        most_freq_str(curr_dict, mfs);
-      }
+      mf_str = STRING_ELT(
+        dict, refinr::most_frequent_value(curr_idx + curr_vect_len,
+                                          curr_idx + curr_idx_len,
+                                          value, scratch) - vect_len
+      );
     }
 
-    // For each index in curr_vect_idx, edit output to be equal to
+    // For each vect index in the cluster, edit output to be equal to
     // most_freq_string.
     for(int n = 0; n < curr_vect_len; ++n) {
-      output[curr_vect_idx[n]] = mfs.mf_str;
+      SET_STRING_ELT(output, curr_idx[n], mf_str);
     }
   }
 
@@ -0,0 +1,136 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Nearest neighbour merging of the unique values of vect, see knn_merge.R.
+// univect holds the unique values of vect, and fp_univect is univect with
+// the R steps of the ngram fingerprint method applied. Values are compared
+// by their normalized strings (see fingerprinter::ngram_normalize()), under
+// method "ppm", computed here on up to nthread threads, or under any other
+// method of the stringdist package, computed by the stringdist C API in
+// batches of pairs with the args method (the stringdist method code),
+// weight, p, bt, q, useBytes and nthread. counts holds the number of times
+// each element of vect was counted, or is empty if each element counts once.
+// progress is an R callback for progress reports, or NULL (see
+// progress.cpp).
+// Returns a list holding the output vector, and the number of candidate
+// pairs within the blocks.
+// [[Rcpp::export]]
+List knn_merge_cpp(const CharacterVector &vect,
+                   const CharacterVector &univect,
+                   const CharacterVector &fp_univect,
+                   const bool &ppm,
+                   const double &radius,
+                   const int &block_chars,
+                   const bool &bus_suffix,
+                   const CharacterVector &ignore_strings,
+                   const SEXP &method,
+                   const SEXP &weight,
+                   const SEXP &p,
+                   const SEXP &bt,
+                   const SEXP &q,
+                   const SEXP &useBytes,
+                   const SEXP &nthread,
+                   const NumericVector &counts,
+                   const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+  int univect_len = univect.size();
+
+  // Get the groups of vect indices holding each univect value, and the
+  // count of each univect value.
+  prog.stage("index", vect.size());
+  refinr_groups univect_groups = create_groups(vect, univect, prog);
+  std::vector<double> univect_counts = value_counts(univect_groups, counts);
+
+  // Normalize the unique values into an arena on the main thread, so that
+  // the distances can be computed off it.
+  refinr::string_arena norm;
+  std::string buf;
+  prog.stage("fingerprint", univect_len);
+  for(int u = 0; u < univect_len; ++u) {
+    fp.ngram_normalize(char_view(STRING_ELT(fp_univect, u)), buf);
+    norm.push(buf);
+    prog.step();
+  }
+
+  prog.stage("block", univect_len);
+  refinr::knn_blocking kb = refinr::knn_blocks(
+    univect_len, [&](int u) { return norm[u]; }, block_chars, prog
+  );
+  double n_pairs = refinr::block_pairs(kb.blocks);
+
+  // Find the pairs of neighbours.
+  std::vector<std::pair<int, int> > pairs;
+  prog.stage("distance", n_pairs, 1);
+  if(ppm) {
+    pairs = refinr::knn_pairs(
+      kb,
+      [&]() {
+        return [&, dist = refinr::ppm_distance()](int u, int v) mutable {
+          return dist(norm[u], norm[v]);
+        };
+      },
+      radius, Rf_asInteger(nthread), prog
+    );
+  } else {
+    // The same distances as n_gram_merge(), from the stringdist C API, which
+    // runs its own threads.
+    CharacterVector norm_strs(univect_len);
+    for(int u = 0; u < univect_len; ++u) {
+      std::string_view s = norm[u];
+      SET_STRING_ELT(norm_strs, u,
+                     Rf_mkCharLenCE(s.data(), s.size(), CE_UTF8));
+    }
+    CharacterVector a;
+    CharacterVector b;
+    pairs = refinr::knn_pairs_batched(
+      kb,
+      [&](const std::vector<std::pair<int, int> > &batch,
+          std::vector<double> &out) {
+        int n = batch.size();
+        if(a.size() != n) {
+          a = CharacterVector(n);
+          b = CharacterVector(n);
+        }
+        for(int i = 0; i < n; ++i) {
+          SET_STRING_ELT(a, i, STRING_ELT(norm_strs, batch[i].first));
+          SET_STRING_ELT(b, i, STRING_ELT(norm_strs, batch[i].second));
+        }
+        NumericVector x = stringdist_elementwise(a, b, method, weight, p, bt,
+                                                 q, useBytes, nthread);
+        out.assign(x.begin(), x.end());
+      },
+      radius, prog
+    );
+  }
+
+  // Merge each cluster into its most frequent value, then edit each element
+  // of vect that holds a merged value.
+  refinr_groups clusters = refinr::knn_clusters(univect_len, pairs);
+  std::vector<int> canonical(univect_len);
+  for(int u = 0; u < univect_len; ++u) {
+    canonical[u] = u;
+  }
+  prog.stage("merge", clusters.size());
+  refinr::merge_clusters(
+    clusters, univect_counts,
+    [&](int u) { return char_view(STRING_ELT(univect, u)); }, canonical, prog
+  );
+
+  CharacterVector output = copy_strings(vect);
+  for(int u = 0; u < univect_len; ++u) {
+    if(canonical[u] == u) {
+      continue;
+    }
+    SEXP mf_str = STRING_ELT(univect, canonical[u]);
+    for(const int* i = univect_groups.begin(u); i != univect_groups.end(u);
+        ++i) {
+      SET_STRING_ELT(output, *i, mf_str);
+    }
+  }
+
+  return List::create(_["output"] = output,
+                      _["candidate_pairs"] = n_pairs);
+}
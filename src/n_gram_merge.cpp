@@ -4,454 +4,605 @@ using namespace Rcpp;
 
 
 // Iterate over all clusters, make mass edits to obj "vect", related to each
-// cluster.
-CharacterVector merge_ngram_clusters(List &clusters,
-                                     CharacterVector &n_gram_keys,
+// cluster. Each cluster span of obj "clusters" holds indices of univect.
+// counts holds the number of times each element of vect was counted, or is
+// empty if each element counts once. The count of each univect value is
+// written to univect_counts. Reports the "index" and "merge" stages to
+// prog.
+CharacterVector merge_ngram_clusters(const refinr_groups &clusters,
                                      const CharacterVector &univect,
-                                     CharacterVector &vect) {
-  CharacterVector output = clone(vect);
-
-  // Unlist clusters to a char vector, and get uniques.
-  CharacterVector clust_unlist = unique(noNA(cpp_unlist(clusters)));
-
-  // Create maps
-  refinr_map ngram_map = create_map_no_na(n_gram_keys, clust_unlist);
-  refinr_map univect_map = create_map_no_na(vect, univect);
-
-  // initialize iterators.
-  List::iterator clust_end = clusters.end();
-  List::iterator iter;
+                                     const CharacterVector &vect,
+                                     const NumericVector &counts,
+                                     std::vector<double> &univect_counts,
+                                     refinr::progress &prog) {
+  CharacterVector output = copy_strings(vect);
+
+  // Group the indices of vect by value, group u holds the indices of vect
+  // that are equal to univect[u], and get the count of each univect value.
+  prog.stage("index", vect.size());
+  refinr_groups univect_groups = create_groups(vect, univect, prog);
+  univect_counts = value_counts(univect_groups, counts);
+  int clusters_len = clusters.size();
+  prog.stage("merge", clusters_len);
 
   // Initialize variables used throughout the loop below.
-  CharacterVector curr_clust;
-  freq_string mfs;
-  int curr_clust_len;
-  int ngram_idx_len;
-  int univect_sub_len;
-  int uni_idx_len;
-  std::string curr_clust_str;
-  std::vector<int> uni_idx;
-  std::vector<int> curr_uni_idx;
-  std::vector<int> ngram_idx;
-  std::vector<int> curr_ngram_idx;
-
-  // refinr_map uses pointers to CHARSXP SEXP as keys. In the loop below,
-  // there are two points in which elements of CharacterVectors will be looked
-  // up in the two refinr_maps (ngram_map, univect_map), object "ptr" is used
-  // in each instance to house pointers to the underlying SEXP of the
-  // CharacterVectors.
-  SEXP* ptr;
-
-  for(iter = clusters.begin(); iter != clust_end; ++iter) {
-    curr_clust = *iter;
-    ptr = get_string_ptr(curr_clust);
-
-    // Create subset of univect using the indices of n_gram_keys that appear
-    // in curr_clust.
-    curr_clust_len = curr_clust.size();
-    ngram_idx.clear();
-    for(int i = 0; i < curr_clust_len; ++i) {
-      curr_ngram_idx = ngram_map[ptr[i]];
-      ngram_idx.insert(
-        ngram_idx.end(), curr_ngram_idx.begin(), curr_ngram_idx.end()
-      );
+  auto count = [&](int u) { return univect_counts[u]; };
+  auto value = [&](int u) { return char_view(STRING_ELT(univect, u)); };
+  const int* curr_idx;
+  int curr_idx_len;
+  int mf_idx;
+  SEXP mf_str;
+
+  for(int j = 0; j < clusters_len; ++j) {
+    curr_idx = clusters.begin(j);
+    curr_idx_len = clusters.len(j);
+    prog.step();
+
+    // Find the string that appears most frequently in vect across the
+    // cluster. Ties are determined by the string that appears first
+    // alphabetically.
+    mf_idx = refinr::most_frequent(curr_idx, curr_idx + curr_idx_len, count,
+                                   value);
+    if(mf_idx < 0) {
+      continue;
     }
-    ngram_idx_len = ngram_idx.size();
-    CharacterVector univect_sub(ngram_idx_len);
-    for(int i = 0; i < ngram_idx_len; ++i) {
-      univect_sub[i] = univect[ngram_idx[i]];
+    mf_str = STRING_ELT(univect, mf_idx);
+
+    // Edit all elements of vect related to the cluster to be equal to
+    // most_freq_string.
+    for(int i = 0; i < curr_idx_len; ++i) {
+      const int* vect_idx = univect_groups.begin(curr_idx[i]);
+      const int* vect_idx_end = univect_groups.end(curr_idx[i]);
+      for( ; vect_idx != vect_idx_end; ++vect_idx) {
+        SET_STRING_ELT(output, *vect_idx, mf_str);
+      }
     }
+  }
 
-    // Create subset of vect using the elements of univect_sub.
-    ptr = get_string_ptr(univect_sub);
-    univect_sub_len = univect_sub.size();
-    uni_idx.clear();
-    for(int i = 0; i < univect_sub_len; ++i) {
-      curr_uni_idx = univect_map[ptr[i]];
-      uni_idx.insert(
-        uni_idx.end(), curr_uni_idx.begin(), curr_uni_idx.end()
-      );
-    }
-    uni_idx_len = uni_idx.size();
-    CharacterVector vect_sub(uni_idx_len);
-    for(int i = 0; i < uni_idx_len; ++i) {
-      vect_sub[i] = vect[uni_idx[i]];
-    }
+  return output;
+}
 
-    // Find the string that appears most frequently in vect_sub.
-    most_freq_str(vect_sub, mfs);
 
-    // Edit all elements of output[uni_idx] to be equal to most_freq_string.
-    for(int n = 0; n < uni_idx_len; ++n) {
-      output[uni_idx[n]] = mfs.mf_str;
+// The count of each value, given the groups of element indices holding each
+// value (see create_groups()): the number of elements in the group, or if
+// counts is not empty, the sum of the counts of those elements.
+std::vector<double> value_counts(const refinr_groups &univect_groups,
+                                 const NumericVector &counts) {
+  int n = univect_groups.size();
+  std::vector<double> out(n, 0);
+  for(int u = 0; u < n; ++u) {
+    if(counts.size() == 0) {
+      out[u] = univect_groups.len(u);
+      continue;
+    }
+    for(const int* i = univect_groups.begin(u); i != univect_groups.end(u);
+        ++i) {
+      out[u] += counts[*i];
     }
   }
-
-  return output;
+  return out;
 }
 
 
 // Prep steps prior to the merging of clusters, given that approximate string
 // matching is NOT being used (via arg edit_threshold). Generate clusters by
-// finding all elements of n_gram_keys that have one or more identical
-// matches, then pass args along to merge_ngram_clusters().
+// finding all elements of univect whose ngram keys have one or more
+// identical matches, then pass args along to merge_ngram_clusters().
+// fp_univect is univect with the R steps of the fingerprint method applied
+// (see get_fingerprint.R), the keys are computed here. counts holds the
+// number of times each element of vect was counted, or is empty if each
+// element counts once. progress is an R callback for progress reports, or
+// NULL (see progress.cpp).
 // [[Rcpp::export]]
-CharacterVector ngram_merge_no_approx(CharacterVector &n_gram_keys,
+CharacterVector ngram_merge_no_approx(const CharacterVector &fp_univect,
                                       const CharacterVector &univect,
-                                      CharacterVector &vect) {
-  // Find all elements of n_gram_keys that have one or more identical
-  // matches.
-  CharacterVector n_gram_keys_dups = cpp_get_key_dups(n_gram_keys);
+                                      const CharacterVector &vect,
+                                      const int &numgram,
+                                      const bool &bus_suffix,
+                                      const CharacterVector &ignore_strings,
+                                      const NumericVector &counts,
+                                      const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+
+  // Group the indices of univect by ngram key, only keeping keys that have
+  // one or more identical matches, so each group is a cluster of univect
+  // indices.
+  std::vector<int> key_ids;
+  prog.stage("fingerprint", fp_univect.size());
+  int n_keys = fingerprint_key_ids(fp_univect, fp, numgram, key_ids, prog);
+  refinr_groups clusters = refinr::build_groups(key_ids, n_keys, 2);
 
   // If no duplicated keys exist, return vect unedited.
-  if(n_gram_keys_dups.size() == 0) {
+  if(clusters.size() == 0) {
     return(vect);
   }
 
-  // Cast n_gram_keys_dups as a list.
-  List clusters = cpp_as_list(n_gram_keys_dups);
-
   // Pass clusters and other args along to merge_ngram_clusters().
-  return(merge_ngram_clusters(clusters, n_gram_keys, univect, vect));
+  std::vector<double> univect_counts;
+  return(merge_ngram_clusters(clusters, univect, vect, counts,
+                              univect_counts, prog));
 }
 
 
 // Prep steps prior to the merging of clusters, given that approximate string
 // matching is being used (via arg edit_threshold).
-// Create initial clusters, filter clusters based on matrices of numeric
-// string edit distance values, then pass args along to merge_ngram_clusters().
+// Get the clusters of univect (see ngram_approx_clusters()), then pass args
+// along to merge_ngram_clusters(). Returns a list holding the output vector,
+// a named vector counting the clusters evaluated with each distance
+// strategy along with the largest number of bytes held for distances, the
+// number of candidate pairs of keys within the initial clusters, and a named
+// vector of the share of them that was evaluated within time_budget (see
+// distance_coverage()). time_budget is the number of seconds left for the
+// edit distances, Inf for no limit (see filter_ngram_blocks()).
+// counts holds the number of times each element of vect was counted, or is
+// empty if each element counts once. progress is an R callback for progress
+// reports, or NULL (see progress.cpp).
 // [[Rcpp::export]]
-CharacterVector ngram_merge_approx(CharacterVector &n_gram_keys,
-                                   CharacterVector &one_gram_keys,
-                                   const CharacterVector &univect,
-                                   CharacterVector &vect,
-                                   const double &edit_threshold,
-                                   const SEXP &method,
-                                   const SEXP &weight,
-                                   const SEXP &p,
-                                   const SEXP &bt,
-                                   const SEXP &q,
-                                   const SEXP &useBytes,
-                                   const SEXP &nthread) {
-  // Get initial clusters.
-  List initial_clust = get_ngram_initial_clusters(n_gram_keys, one_gram_keys);
-
-  // Create an edit distance matrix for each initial cluster, using the
-  // function "sd_lower_tri()" from the stringdist package.
-  List distmatrices = get_stringdist_matrices(initial_clust, method, weight, p,
-                                              bt, q, useBytes, nthread);
-
-  // For each matrix in distmatrices, create clusters of matches within the
-  // matrix, based on lowest numeric edit distance (matches must have a value
-  // below edit_threshold in order to be considered suitable for merging).
-  List clusters = filter_initial_clusters(distmatrices, edit_threshold,
-                                          initial_clust);
-
-  // If length of clusters is zero, return vect unedited.
-  if(clusters.size() == 0) return(vect);
-
-  // Pass args along to merge_ngram_clusters().
-  return(merge_ngram_clusters(clusters, n_gram_keys, univect, vect));
-}
-
-
-// Get initial ngram clusters.
-// For each string in unigram_dups, find indices in which that string appears
-// in unigram_keys, then use those indices to get a subset of ngram_keys. Add
-// the subset to List "out". After "out" is compiled, remove elements of the
-// list that have length less than 2.
-List get_ngram_initial_clusters(CharacterVector ngram_keys,
-                                CharacterVector unigram_keys) {
-  CharacterVector unigram_dups = cpp_get_key_dups(unigram_keys);
-  List out(unigram_dups.size());
-
-  // Remove indices from ngram_keys and unigram_keys in which ngram_keys are
-  // NA.
-  LogicalVector na_idx = !is_na(ngram_keys);
-  ngram_keys = ngram_keys[na_idx];
-  unigram_keys = unigram_keys[na_idx];
-
-  // Create unordered_map, using unigram_dups as keys, values will be the
-  // indices of each unigram_dup in unigram_keys.
-  refinr_map unigram_map = create_map(unigram_keys, unigram_dups);
-
-  // refinr_map uses pointers to CHARSXP SEXP as keys. Get pointers to the
-  // SEXP unigram_dups, to iterate over in the loop below.
-  SEXP* ptr = get_string_ptr(unigram_dups);
-
-  std::vector<int> curr_idx;
-  std::vector<std::string> curr_ngram;
-  std::string curr_str;
-
-  // Iterate over unigram_dups, for each value get the corresponding indices
-  // from unigram_map, Use those indices to subset ngram_keys, save the subset
-  // to the list output.
-  for(unsigned int j = 0; j < unigram_dups.size(); ++j) {
-    // Create subset of ngram_keys using the indices from unigram_map that
-    // correspond to the current unigram_dup iteration.
-    curr_idx = unigram_map[ptr[j]];
-    curr_ngram.clear();
-    for(unsigned int n = 0; n < curr_idx.size(); ++n) {
-      curr_str = ngram_keys[curr_idx[n]];
-      curr_ngram.push_back(curr_str);
-    }
-
-    out[j] = curr_ngram;
+List ngram_merge_approx(const CharacterVector &fp_univect,
+                        const CharacterVector &univect,
+                        const CharacterVector &vect,
+                        const int &numgram,
+                        const bool &bus_suffix,
+                        const CharacterVector &ignore_strings,
+                        const double &edit_threshold,
+                        const double &dist_budget,
+                        const std::string &blocking,
+                        const int &bands,
+                        const int &rows,
+                        const int &window,
+                        const SEXP &method,
+                        const SEXP &weight,
+                        const SEXP &p,
+                        const SEXP &bt,
+                        const SEXP &q,
+                        const SEXP &useBytes,
+                        const SEXP &nthread,
+                        const double &time_budget,
+                        const NumericVector &counts,
+                        const SEXP &progress) {
+  ngram_approx_args args = {
+    edit_threshold, dist_budget, blocking, bands, rows, window,
+    {method, weight, p, bt, q, useBytes, nthread}, time_budget
+  };
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+
+  ngram_approx_stats stats;
+  refinr_groups clusters = ngram_approx_clusters(fp_univect, fp, numgram,
+                                                 args, stats, prog);
+
+  // If no clusters were found, return vect unedited.
+  CharacterVector output = vect;
+  if(clusters.size() > 0) {
+    std::vector<double> univect_counts;
+    output = merge_ngram_clusters(clusters, univect, vect, counts,
+                                  univect_counts, prog);
   }
 
-  return out;
+  return List::create(_["output"] = output,
+                      _["distance_plan"] = distance_plan(stats),
+                      _["candidate_pairs"] = stats.n_pairs,
+                      _["coverage"] = distance_coverage(stats));
 }
 
 
-// Take in a list of character vectors, create a stringdist edit matrix for
-// each vector, return a list of edit matrices.
-List get_stringdist_matrices(const List &clusters,
-                             const SEXP &method,
-                             const SEXP &weight,
-                             const SEXP &p,
-                             const SEXP &bt,
-                             const SEXP &q,
-                             const SEXP &useBytes,
-                             const SEXP &nthread) {
-  int clust_len = clusters.size();
-  List out(clust_len);
-  NumericVector x;
-  SEXP curr_clust;
-  int mat_dim;
-  int iter_len;
-  int x_val;
-
-  for(int j = 0; j < clust_len; ++j) {
-    curr_clust = clusters[j];
-    // Run args through stringdist sd_lower_tri C function.
-    x = stringdist_lower_tri(curr_clust, method, weight, p,
-                             bt, q, useBytes, nthread);
-    // Initialize output matrix.
-    mat_dim = Rf_xlength(curr_clust);
-    NumericMatrix mat(mat_dim, mat_dim);
-
-    iter_len = mat_dim - 1;
-    x_val = 0;
-
-    // Loop to fill in the lower and upper tri of mat with the numeric values
-    // of x.
-    for(int i = 0; i < iter_len; ++i) {
-      for(int n = i + 1; n < mat_dim; ++n) {
-        // Fill in lower tri.
-        mat(n,i) = x[x_val];
-        // Fill in upper tri.
-        mat(i,n) = x[x_val];
-        //Bump x_val.
-        x_val++;
-      }
-    }
-
-    out[j] = mat;
+// Get clusters of similar elements of univect by approximate string
+// matching, as groups of univect indices.
+// Create initial clusters, then filter each cluster based on the numeric
+// string edit distances between its keys (see filter_ngram_blocks()). stats
+// counts the clusters evaluated with each distance strategy, the largest
+// number of bytes held for distances, and the number of candidate pairs of
+// keys within the initial clusters.
+// Keys are grouped on their hashes, key strings are only created for the
+// elements of initial clusters, to compute their edit distances.
+refinr_groups ngram_approx_clusters(const CharacterVector &fp_univect,
+                                    const refinr::fingerprinter &fp,
+                                    const int &numgram,
+                                    const ngram_approx_args &args,
+                                    ngram_approx_stats &stats,
+                                    refinr::progress &prog) {
+  // Normalize each element once, and cut its ngram key (and its unigram key,
+  // for unigram blocking) from the normalized string in the same pass. Give
+  // each key an integer id, and group the univect indices by ngram key. The
+  // normalized strings are kept, to cut the key strings compared by edit
+  // distance from.
+  int univect_len = fp_univect.size();
+  bool unigram = args.blocking == "unigram";
+  std::vector<int> orders = {numgram};
+  if(unigram) {
+    orders.push_back(1);
   }
-
-  return(out);
+  refinr::string_arena norms;
+  std::vector<std::vector<int> > ids;
+  prog.stage("fingerprint", univect_len);
+  std::vector<int> n_ids = refinr::ngram_key_ids(
+    fp, univect_len,
+    [&](int i) { return char_view(STRING_ELT(fp_univect, i)); },
+    orders, norms, ids, prog
+  );
+  const std::vector<int> &key_ids = ids[0];
+  refinr_groups key_groups = refinr::build_groups(key_ids, n_ids[0], 1);
+
+  // Get initial clusters, as groups of univect indices, and filter them.
+  refinr_groups initial_clust = get_ngram_initial_clusters(
+    norms, key_ids, key_groups, unigram ? ids[1] : std::vector<int>(),
+    unigram ? n_ids[1] : 0, numgram, args, stats.n_pairs, prog
+  );
+  std::string key;
+  block_cache cache;
+  return filter_ngram_blocks(
+    initial_clust, key_ids, key_groups,
+    [&](int u) {
+      refinr::fingerprinter::ngram_key(norms[u], numgram, key);
+      return Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8);
+    },
+    args, stats, cache, prog
+  );
 }
 
 
-// Filter stringdist matrices.
-// Function takes a list of matrices of edit distances, each created by pkg
-// stringdist. For each element of distmatrices, create clusters of matches
-// within the matrix, based on lowest numeric edit distance. (matches must
-// have a value below edit_threshold in order to be considered a cluster
-// suitable for merging).
-List filter_initial_clusters(const List &distmatrices,
-                             const double &edit_threshold,
-                             const List &clusters) {
-  int distmatrices_len = distmatrices.size();
-  List out(distmatrices_len);
-  LogicalVector na_filter(distmatrices_len);
-
-  CharacterVector curr_clust;
-  CharacterVector max_clust;
-  CharacterVector terms;
-  NumericMatrix curr_mat;
-  std::vector<int> lows_idx;
-  std::vector<double> lows;
-  std::vector<double> curr_row;
-  double lowest;
-  int lowest_count;
-  int lows_idx_len;
-  int clust_len;
-  int max_clust_idx;
-  int mat_nrow;
-
-  for(int i = 0; i < distmatrices_len; ++i) {
-    // Get current matrix object, establish other variables.
-    curr_mat = as<NumericMatrix>(distmatrices[i]);
-    mat_nrow = curr_mat.nrow();
-
-    if(mat_nrow < 2) {
-      curr_clust = clusters[i];
-      out[i] = curr_clust;
-      na_filter[i] = TRUE;
-      continue;
-    }
-
-    // For each row of curr_mat, get the min value present. If none are below
-    // the edit_threshold, append NA to the output and move to the next
-    // iteration. Also ID whether or not any of the rows of curr_mat have more
-    // than one cluster match (ie a min value that repeats within any given
-    // row).
-    IntegerVector olap(mat_nrow, 0);
-    curr_row.clear();
-    lows.clear();
-    lows_idx.clear();
-    for(int row_idx = 0; row_idx < mat_nrow; ++row_idx) {
-      curr_row.clear();
-      for(int n = 0; n < mat_nrow; ++n) {
-        if(n != row_idx) {
-          curr_row.push_back(curr_mat(row_idx, n));
-        }
-      }
-      lowest = *std::min_element(curr_row.begin(), curr_row.end());
-      lows.push_back(lowest);
-      if(lowest < edit_threshold) {
-        lowest_count = 0;
-        for(unsigned int n = 0; n < curr_row.size(); ++n) {
-          if(curr_row[n] == lowest) {
-            lowest_count += 1;
-          }
-        }
-        olap[row_idx] = lowest_count;
-        lows_idx.push_back(row_idx);
+// Filter each initial cluster (a group of univect indices) by the numeric
+// string edit distances between the ngram keys of its elements, and return
+// the resulting clusters as groups of univect indices. key_ids holds the
+// ngram key id of each element of univect, key_groups the elements of each
+// key, and key_char(u) gives the ngram key of element u as a CHARSXP.
+// Initial clusters are processed one at a time. The edit distances of a
+// cluster are computed as one lower triangle (dense) if that fits within
+// args.dist_budget bytes, otherwise they are computed one row at a time
+// (streamed). stats counts the clusters evaluated with each strategy and the
+// largest number of bytes held for distances. An initial cluster found in
+// cache reuses the clusters it was filtered into by an earlier run instead
+// of computing its distances, and every initial cluster is recorded to cache
+// along with the clusters it was filtered into (see block_cache).
+// If args.time_budget is finite, elements sharing an ngram key are clustered
+// up front, then the initial clusters are filtered smallest first, until
+// the next one would run past args.time_budget seconds at the rate of the
+// ones before it. The rest are left out, and stats counts the initial
+// clusters and pairs of keys that were filtered. Either way, the clusters of
+// the filtered initial clusters are returned in the order of the initial
+// clusters, so that a run that fits the budget gives the same clusters as a
+// run without one. Elements sharing a key are always in a common cluster of
+// their initial cluster, so the clusters of shared keys then change
+// nothing.
+refinr_groups filter_ngram_blocks(const refinr_groups &initial_clust,
+                                  const std::vector<int> &key_ids,
+                                  const refinr_groups &key_groups,
+                                  const std::function<SEXP(int)> &key_char,
+                                  const ngram_approx_args &args,
+                                  ngram_approx_stats &stats,
+                                  block_cache &cache,
+                                  refinr::progress &prog) {
+  int initial_clust_len = initial_clust.size();
+
+  // For each initial cluster, create clusters of matches within the cluster,
+  // based on lowest numeric edit distance (matches must have a value below
+  // edit_threshold in order to be considered suitable for merging). Each
+  // resulting cluster is a vector of key ids.
+  std::vector<std::vector<int> > key_clusters;
+  std::vector<int> curr_ids;
+  const int* curr_idx;
+  int curr_len;
+  double curr_pairs;
+  double curr_bytes;
+  bool streamed;
+  size_t first_cluster;
+
+  // With a time budget, filter the initial clusters smallest first. The
+  // clusters of initial cluster i are key_clusters[first[i]] through
+  // key_clusters[last[i] - 1].
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  bool anytime = std::isfinite(args.time_budget);
+  std::vector<int> order(initial_clust_len);
+  std::iota(order.begin(), order.end(), 0);
+  if(anytime) {
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return initial_clust.len(a) < initial_clust.len(b);
+    });
+  }
+  std::vector<size_t> first(initial_clust_len, 0);
+  std::vector<size_t> last(initial_clust_len, 0);
+  stats.n_blocks = initial_clust_len;
+
+  // Progress is counted in pairs of keys. The distances of a dense cluster
+  // are computed in one call to stringdist, which can't be interrupted, while
+  // a streamed cluster checks in between rows.
+  prog.stage("distance", stats.n_pairs, 1);
+  for(int i : order) {
+    curr_idx = initial_clust.begin(i);
+    curr_len = initial_clust.len(i);
+    curr_pairs = (double)curr_len * (curr_len - 1) / 2;
+    if(anytime) {
+      double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start
+      ).count();
+      double rate = stats.n_pairs_done > 0 ?
+        elapsed / stats.n_pairs_done : 0;
+      if(elapsed >= args.time_budget ||
+         elapsed + curr_pairs * rate > args.time_budget) {
+        break;
       }
     }
+    curr_bytes = dense_distance_bytes(curr_len);
+    streamed = curr_bytes > args.dist_budget;
+    if(streamed) {
+      curr_bytes = streamed_distance_bytes(curr_len);
+      stats.n_streamed++;
+    } else {
+      stats.n_dense++;
+    }
+    if(curr_bytes > stats.peak_bytes) {
+      stats.peak_bytes = curr_bytes;
+    }
 
-    // If none of the rows in curr_mat contain an edit distance value below
-    // the edit_threshold, return NA and move on to the next iteration.
-    if(lows_idx.size() == 0) {
-      out[i] = NA_STRING;
-      na_filter[i] = FALSE;
-      continue;
+    CharacterVector curr_clust(curr_len);
+    curr_ids.resize(curr_len);
+    for(int n = 0; n < curr_len; ++n) {
+      SET_STRING_ELT(curr_clust, n, key_char(curr_idx[n]));
+      curr_ids[n] = key_ids[curr_idx[n]];
     }
 
-    // Trim obj olap to only include elements related to clusters that have an
-    // edit distance less than edit_threshold.
-    olap = olap[olap > 0];
-
-    // Generate clusters of char keys based on the edit distance matrix values.
-    lows_idx_len = lows_idx.size();
-    List clust(lows_idx_len);
-    LogicalVector trim_idx(lows_idx_len, TRUE);
-    NumericVector lens_of_clusts(lows_idx_len);
-    curr_clust = clusters[i];
-    for(int n = 0; n < lows_idx_len; ++n) {
-      terms = curr_clust[curr_mat(lows_idx[n], _) < edit_threshold];
-      terms = unique(noNA(terms));
-      clust[n] = terms;
-      lens_of_clusts[n] = terms.size();
-      // Check to see if terms is a complete subset of an existing cluster.
-      if(n > 0) {
-        for(int k = 0; k < n; ++k) {
-          if(cpp_all(terms, clust[k])) {
-            trim_idx[n] = FALSE;
-            break;
+    first_cluster = key_clusters.size();
+    if(!cache.find(curr_clust, curr_ids, key_clusters)) {
+      cluster_distances dists(curr_clust, streamed, args.sd_args);
+      refinr::filter_block(
+        curr_ids.data(), curr_len,
+        [&](int r, std::vector<double> &out) {
+          if(streamed) {
+            prog.poll();
           }
-        }
-      }
+          dists.row(r, out);
+        },
+        args.edit_threshold, key_clusters
+      );
     }
+    cache.record(curr_ids, key_clusters, first_cluster);
+    first[i] = first_cluster;
+    last[i] = key_clusters.size();
+    stats.n_blocks_done++;
+    stats.n_pairs_done += curr_pairs;
+    prog.step(curr_pairs);
+  }
 
-    // trim objs clust and olap to only include unique clusters.
-    clust = clust[trim_idx];
-    lens_of_clusts = lens_of_clusts[trim_idx];
-    olap = olap[trim_idx];
-
-    // If any rows of curr_mat have a min edit distance that repeats,
-    // eliminate any clusters that are complete subsets of the longest
-    // cluster of the group.
-    clust_len = clust.size();
-    if(sum(noNA(olap > 1)) > 0 and clust_len > 1) {
-      // Eliminate any clusters that are complete subsets of the longest
-      // cluster of the group.
-      max_clust_idx = which_max(noNA(lens_of_clusts));
-      max_clust = clust[max_clust_idx];
-      LogicalVector clust_bool(clust_len, TRUE);
-
-      for(int n = 0; n < clust_len; ++n) {
-        if(n == max_clust_idx) {
-          continue;
-        }
-        clust_bool[n] = !cpp_all(clust[n], max_clust);
+  // Convert the clusters of keys into clusters of univect indices, by
+  // concatenating the univect indices of each key, in the order of the
+  // initial clusters, after the clusters of shared keys if there is a time
+  // budget.
+  refinr_groups clusters;
+  if(anytime) {
+    for(int k = 0; k < key_groups.size(); ++k) {
+      if(key_groups.len(k) > 1) {
+        clusters.push_back(key_groups.begin(k), key_groups.end(k));
       }
-
-      clust = clust[clust_bool];
     }
-
-    out[i] = clust;
-    na_filter[i] = TRUE;
+  }
+  for(int i = 0; i < initial_clust_len; ++i) {
+    for(size_t c = first[i]; c < last[i]; ++c) {
+      for(int k : key_clusters[c]) {
+        clusters.members.insert(clusters.members.end(), key_groups.begin(k),
+                                key_groups.end(k));
+      }
+      clusters.offsets.push_back(clusters.members.size());
+    }
   }
 
-  // Subset to remove empty elements of the output list.
-  out = out[na_filter];
+  return clusters;
+}
 
-  // Flatten nested lists so that each element of clusters is a char vector.
-  out = cpp_flatten_list(out);
 
-  return out;
+// Named vector reporting the distance strategies of a run, see
+// add_distance_stage() in memory.R.
+NumericVector distance_plan(const ngram_approx_stats &stats) {
+  return NumericVector::create(
+    _["dense"] = stats.n_dense,
+    _["streamed"] = stats.n_streamed,
+    _["peak_bytes"] = stats.peak_bytes
+  );
 }
 
 
-// Takes a list of character vectors as input. Each char vector will be a
-// string that's been tokenized by individual char. This function iterates
-// over the list, for each char vector it will compile every available ngram
-// of length equal to arg numgram. Output is a list of ngrams as char vectors.
-List char_ngram(const std::vector<std::string> &strings, const int &numgram) {
-  int strings_len = strings.size();
-  List out(strings_len);
-  int numgram_sub = numgram - 1;
-
-  IntegerVector idx;
-  std::vector<std::string> curr_out;
-  std::string curr_str;
-  std::string curr_token;
-  int curr_str_len;
-
-  for(int i = 0; i < strings_len; ++i) {
-    curr_str = strings[i];
-    curr_str_len = curr_str.size() - numgram_sub;
-    if(curr_str_len <= 0 or curr_str == "NA") {
-      out[i] = NA_STRING;
-      continue;
+// Named vector reporting how much of the candidate space of a run was
+// filtered: the share of candidate pairs of keys, and the number of initial
+// clusters and of candidate pairs that were filtered, out of the total.
+NumericVector distance_coverage(const ngram_approx_stats &stats) {
+  return NumericVector::create(
+    _["covered"] = stats.n_pairs > 0 ? stats.n_pairs_done / stats.n_pairs : 1,
+    _["blocks_done"] = stats.n_blocks_done,
+    _["blocks"] = stats.n_blocks,
+    _["pairs_done"] = stats.n_pairs_done,
+    _["pairs"] = stats.n_pairs
+  );
+}
+
+
+// Get initial ngram clusters, as groups of univect indices. norms holds the
+// normalized string of each element of univect, key_ids the id of its ngram
+// key, and key_groups the elements of each key. Elements without an ngram
+// key (key_ids of -1) are left out of the groups.
+// If args.blocking is "unigram", group the indices of univect by unigram key
+// (unigram_ids, holding n_unigram_keys distinct keys), keeping keys that
+// have at least one duplicate.
+// If args.blocking is "minhash", compute MinHash signatures over the ngrams
+// (of length numgram) of each element (on up to nthread threads), and group
+// the indices of univect by LSH bucket (see refinr/minhash.h). An element
+// may appear in several buckets.
+// If args.blocking is "sorted", sort the ngram keys three ways (by key, by
+// key read backwards, and by the normalized string of their first element),
+// and compare each key with the next args.window keys of each ordering
+// under the stringdist args. Keys within args.edit_threshold of each other
+// are matched, and the elements of each key and the keys it matched form a
+// cluster (see refinr/neighbourhood.h).
+// n_pairs is set to the number of candidate pairs within the clusters.
+// Reports the "block" stage to prog, or the "signature" and "bucket" stages
+// if blocking is "minhash".
+refinr_groups get_ngram_initial_clusters(const refinr::string_arena &norms,
+                                         const std::vector<int> &key_ids,
+                                         const refinr_groups &key_groups,
+                                         const std::vector<int> &unigram_ids,
+                                         const int &n_unigram_keys,
+                                         const int &numgram,
+                                         const ngram_approx_args &args,
+                                         double &n_pairs,
+                                         refinr::progress &prog) {
+  int univect_len = norms.size();
+  const SEXP &nthread_arg = args.sd_args.nthread;
+  int nthread = Rf_isNull(nthread_arg) ? 1 : Rf_asInteger(nthread_arg);
+
+  if(args.blocking == "minhash") {
+    // The normalized strings are only read, so the signatures can be
+    // computed off the main thread.
+    refinr::minhasher mh(args.bands, args.rows);
+    prog.stage("signature", univect_len, 1);
+    std::vector<uint64_t> sigs = refinr::minhash_signatures(
+      mh, univect_len, numgram,
+      [&](int i, std::string &out) { out.assign(norms[i]); },
+      nthread, prog
+    );
+    prog.stage("bucket", (double)univect_len * args.bands);
+    return mh.buckets(univect_len, sigs,
+                      [&](int i) { return key_ids[i] < 0; }, n_pairs, prog);
+  }
+
+  if(args.blocking == "sorted") {
+    // Cut the key string of each key from the normalized string of its
+    // first element, into an arena for sorting, and into a character vector
+    // for stringdist.
+    int n_keys = key_groups.size();
+    refinr::string_arena keys;
+    CharacterVector key_strs(n_keys);
+    std::string key;
+    for(int k = 0; k < n_keys; ++k) {
+      refinr::fingerprinter::ngram_key(norms[*key_groups.begin(k)], numgram,
+                                       key);
+      keys.push(key);
+      SET_STRING_ELT(key_strs, k,
+                     Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8));
     }
-    curr_out.clear();
-    for(int j = 0; j < curr_str_len; ++j) {
-      idx = seq(j, j + numgram_sub);
-      curr_token.clear();
-      for(int k = 0; k < numgram; ++k) {
-        curr_token += curr_str[idx[k]];
+
+    typedef std::function<std::string_view(int)> sort_key;
+    std::vector<sort_key> sort_keys = {
+      [&](int k) { return keys[k]; },
+      [&](int k) { return keys[k]; },
+      [&](int k) { return norms[*key_groups.begin(k)]; }
+    };
+    prog.stage("block", refinr::window_pairs(n_keys, sort_keys.size(),
+                                             args.window), 1);
+    std::vector<std::vector<int> > orders = refinr::sorted_orders(
+      n_keys, sort_keys, {false, true, false}, nthread
+    );
+
+    // Distances of each batch of pairs, in one call to stringdist.
+    CharacterVector a;
+    CharacterVector b;
+    refinr_groups key_blocks = refinr::neighbourhood_blocks(
+      n_keys, orders, args.window,
+      [&](const std::vector<std::pair<int, int> > &pairs,
+          std::vector<double> &out) {
+        int n = pairs.size();
+        if(a.size() != n) {
+          a = CharacterVector(n);
+          b = CharacterVector(n);
+        }
+        for(int p = 0; p < n; ++p) {
+          SET_STRING_ELT(a, p, STRING_ELT(key_strs, pairs[p].first));
+          SET_STRING_ELT(b, p, STRING_ELT(key_strs, pairs[p].second));
+        }
+        NumericVector x = stringdist_elementwise(
+          a, b, args.sd_args.method, args.sd_args.weight, args.sd_args.p,
+          args.sd_args.bt, args.sd_args.q, args.sd_args.useBytes, nthread_arg
+        );
+        out.assign(x.begin(), x.end());
+      },
+      args.edit_threshold, prog
+    );
+
+    // Keep the blocks of keys held by at least two elements.
+    refinr_groups out;
+    for(int g = 0; g < key_blocks.size(); ++g) {
+      size_t start = out.members.size();
+      for(const int* k = key_blocks.begin(g); k != key_blocks.end(g); ++k) {
+        out.members.insert(out.members.end(), key_groups.begin(*k),
+                           key_groups.end(*k));
+      }
+      if(out.members.size() - start < 2) {
+        out.members.resize(start);
+      } else {
+        out.offsets.push_back(out.members.size());
       }
-      curr_out.push_back(curr_token);
     }
-    out[i] = curr_out;
+    n_pairs = refinr::block_pairs(out);
+    return out;
   }
 
-  return(out);
+  prog.stage("block", univect_len);
+  refinr_groups out = refinr::unigram_blocks(key_ids, unigram_ids,
+                                             n_unigram_keys);
+  prog.step(univect_len);
+  n_pairs = refinr::block_pairs(out);
+  return out;
 }
 
 
-// Takes a list of character vectors. For each vector: Get char ngram tokens,
-// reduce to unique tokens, then collapse the tokens back together into single
-// string.
-// [[Rcpp::export]]
-CharacterVector cpp_get_char_ngrams(const std::vector<std::string> &vects,
-                                    const int &numgram) {
+// Bytes held while filtering a cluster of k keys using dense distances: the
+// lower triangle of the distance matrix, plus one row buffer.
+double dense_distance_bytes(const int &k) {
+  return 8.0 * ((double)k * (k - 1) / 2.0 + k);
+}
 
-  // Get character ngrams for each element of vects.
-  List vects_mod = char_ngram(vects, numgram);
 
-  // For each element of vects, reduce values down to uniques, then sort
-  // values alphabetically.
-  vects_mod = cpp_list_unique(vects_mod, TRUE);
+// Bytes held while filtering a cluster of k keys using streamed distances:
+// one row of distances returned by stringdist, plus one row buffer.
+double streamed_distance_bytes(const int &k) {
+  return 16.0 * k;
+}
+
+
+// Create the edit distances between the keys of one cluster. In dense mode,
+// the lower triangle of the distance matrix is computed up front using the
+// function "sd_lower_tri()" from the stringdist package. In streamed mode,
+// each row of the matrix is computed on request using "sd_stringdist()".
+cluster_distances::cluster_distances(const CharacterVector &clust,
+                                     const bool &streamed,
+                                     const stringdist_args &sd_args) :
+  clust(clust), streamed(streamed), sd_args(sd_args), n(clust.size()) {
+  if(streamed) {
+    a = CharacterVector(1);
+  } else {
+    lower_tri = stringdist_lower_tri(clust, sd_args.method, sd_args.weight,
+                                     sd_args.p, sd_args.bt, sd_args.q,
+                                     sd_args.useBytes, sd_args.nthread);
+  }
+}
 
-  // For each element of vects, combine all ngram strings into a single string,
-  // equivalent to calling r func paste(char_vect, collapse = "") on each
-  // element of vects.
-  CharacterVector out = cpp_paste_list(vects_mod, "");
 
-  return(out);
+// Fill "out" with row r of the distance matrix, including the zero distance
+// of key r to itself.
+void cluster_distances::row(const int &r, std::vector<double> &out) {
+  out.resize(n);
+
+  if(streamed) {
+    a[0] = clust[r];
+    NumericVector x = stringdist_elementwise(a, clust, sd_args.method,
+                                             sd_args.weight, sd_args.p,
+                                             sd_args.bt, sd_args.q,
+                                             sd_args.useBytes,
+                                             sd_args.nthread);
+    std::copy(x.begin(), x.end(), out.begin());
+    out[r] = 0;
+    return;
+  }
+
+  // The lower triangle is stored column by column. The distance between
+  // keys i and j (i < j) is at index i * (n - 1) - i * (i - 1) / 2 + j - i - 1.
+  R_xlen_t col_start;
+  for(int c = 0; c < r; ++c) {
+    col_start = (R_xlen_t)c * (n - 1) - (R_xlen_t)c * (c - 1) / 2 - c - 1;
+    out[c] = lower_tri[col_start + r];
+  }
+  out[r] = 0;
+  col_start = (R_xlen_t)r * (n - 1) - (R_xlen_t)r * (r - 1) / 2 - r - 1;
+  for(int c = r + 1; c < n; ++c) {
+    out[c] = lower_tri[col_start + c];
+  }
 }
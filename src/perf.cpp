@@ -0,0 +1,31 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Adapter between the hardware counters of the core library
+// (refinr/perf.h) and the stage profiler of the merge functions, see
+// profile.R.
+
+
+// Get the count of each hardware event of the calling thread (the other
+// threads are not counted, see perf.h), since the counters were opened by
+// the first call of the session. The counters stay open for the rest of the
+// session, so counts of successive calls can be subtracted from each other. Events
+// that can't be counted are NA.
+// [[Rcpp::export]]
+NumericVector perf_read() {
+  static refinr::perf_counters counters;
+  int n = refinr::perf_counters::n_events;
+  std::vector<double> counts(n);
+  counters.read_counts(counts.data());
+
+  NumericVector out(n);
+  CharacterVector names(n);
+  for(int e = 0; e < n; ++e) {
+    out[e] = counts[e] < 0 ? NA_REAL : counts[e];
+    names[e] = refinr::perf_counters::event_name(e);
+  }
+  out.attr("names") = names;
+  return out;
+}
@@ -0,0 +1,51 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Progress adapter between the core library (refinr/progress.h) and R.
+//
+// Every update checks for a user interrupt, so that Ctrl-C stops a long
+// merge, and passes the progress along to the R callback, if there is one.
+// Both are rate limited to one every 100 ms, plus the start of each stage
+// and the first update that reaches its total. The updates that follow the
+// end of a stage (polls for interrupts) are rate limited too. The callback
+// is called as callback(stage, done, total, rate), rate being the items
+// done per second since the start of the stage. If it returns FALSE, the run
+// is cancelled with an error. Interrupts and errors are thrown as c++
+// exceptions, which unwind the loops of the core library and free their
+// buffers before control returns to R.
+
+
+r_progress::r_progress(SEXP callback) :
+  callback(callback),
+  stage_start(std::chrono::steady_clock::now()),
+  last_update(stage_start) {}
+
+
+void r_progress::update(const char* name, double done, double total) {
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+  bool ends = done >= total && last_done < total;
+  if(curr_stage != name) {
+    curr_stage = name;
+    stage_start = now;
+  } else if(!ends && now - last_update < std::chrono::milliseconds(100)) {
+    return;
+  }
+  last_update = now;
+  last_done = done;
+
+  checkUserInterrupt();
+  if(Rf_isNull(callback)) {
+    return;
+  }
+
+  double secs = std::chrono::duration<double>(now - stage_start).count();
+  double rate = secs > 0 ? done / secs : NA_REAL;
+  Function fn(callback);
+  SEXP res = fn(name, done, total, rate);
+  if(Rf_isLogical(res) && Rf_length(res) == 1 && LOGICAL(res)[0] == FALSE) {
+    stop("merge cancelled by the 'progress' callback");
+  }
+}
@@ -0,0 +1,177 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Key collision merging followed by ngram merging, on the unique values of
+// vect, see refine.R.
+// univect holds the unique values of vect, dict the unique values of the
+// reference dict (may be empty). fp_kc and fp_ngram (fp_dict_kc and
+// fp_dict_ngram) are univect (dict) with the R steps of the key collision
+// and ngram fingerprint methods applied. An edit_threshold of NA means no
+// approximate string matching. counts holds the number of times each element
+// of vect was counted, or is empty if each element counts once. progress is
+// an R callback for progress reports, or NULL (see progress.cpp).
+// Returns a list holding the output vector, and the number of candidate
+// pairs of approximate string matching.
+// [[Rcpp::export]]
+List refine_merge(const CharacterVector &vect,
+                  const CharacterVector &univect,
+                  const CharacterVector &fp_kc,
+                  const CharacterVector &fp_ngram,
+                  const CharacterVector &dict,
+                  const CharacterVector &fp_dict_kc,
+                  const CharacterVector &fp_dict_ngram,
+                  const int &numgram,
+                  const bool &bus_suffix,
+                  const CharacterVector &ignore_strings,
+                  const double &edit_threshold,
+                  const std::string &blocking,
+                  const int &bands,
+                  const int &rows,
+                  const int &window,
+                  const SEXP &method,
+                  const SEXP &weight,
+                  const SEXP &p,
+                  const SEXP &bt,
+                  const SEXP &q,
+                  const SEXP &useBytes,
+                  const SEXP &nthread,
+                  const NumericVector &counts,
+                  const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+  int vect_len = vect.size();
+  int univect_len = univect.size();
+  int dict_len = dict.size();
+
+  // Get the univect index of each element of vect (-1 for NA), and the count
+  // of each univect value.
+  prog.stage("index", vect_len);
+  refinr_groups univect_groups = create_groups(vect, univect, prog);
+  std::vector<double> univect_counts = value_counts(univect_groups, counts);
+  std::vector<int> value_ids(vect_len, -1);
+  for(int u = 0; u < univect_len; ++u) {
+    for(const int* i = univect_groups.begin(u); i != univect_groups.end(u);
+        ++i) {
+      value_ids[*i] = u;
+    }
+  }
+
+  // Key collision step. Values 0 to univect_len - 1 are the elements of
+  // univect, followed by the elements of dict. target[u] is the value that
+  // univect element u is merged into.
+  auto kc_value = [&](int i) {
+    return i < univect_len ? char_view(STRING_ELT(univect, i)) :
+      char_view(STRING_ELT(dict, i - univect_len));
+  };
+  auto kc_count = [&](int i) {
+    return i < univect_len ? univect_counts[i] : 1.0;
+  };
+  std::vector<int> kc_ids;
+  prog.stage("key collision", univect_len + dict_len);
+  int n_kc_keys = refinr::hashed_key_ids(
+    univect_len + dict_len,
+    [&](int i, std::string &out) {
+      SEXP x = i < univect_len ? STRING_ELT(fp_kc, i) :
+        STRING_ELT(fp_dict_kc, i - univect_len);
+      return fingerprint_key(fp, 0, x, out);
+    },
+    kc_ids, prog
+  );
+  refinr_groups kc_clusters = refinr::build_groups(kc_ids, n_kc_keys, 2);
+
+  std::vector<int> target(univect_len);
+  for(int u = 0; u < univect_len; ++u) {
+    target[u] = u;
+  }
+  for(int g = 0; g < kc_clusters.size(); ++g) {
+    // Members are sorted, so the univect elements come first, followed by
+    // the dict elements. If the cluster has dict elements, the most
+    // frequent value is taken from them.
+    const int* first = kc_clusters.begin(g);
+    const int* last = kc_clusters.end(g);
+    const int* dict_first = std::lower_bound(first, last, univect_len);
+    if(dict_first == first) {
+      continue;
+    }
+    int mf_idx = dict_first == last ?
+      refinr::most_frequent(first, last, kc_count, kc_value) :
+      refinr::most_frequent(dict_first, last, kc_count, kc_value);
+    for(const int* u = first; u != dict_first; ++u) {
+      target[*u] = mf_idx;
+    }
+    prog.step(0);
+  }
+
+  // The values left after the key collision step, numbered in order of first
+  // appearance within the merged vect, along with their counts and the input
+  // to their ngram fingerprints.
+  std::vector<int> ng_ids(univect_len + dict_len, -1);
+  std::vector<int> ng_values;
+  std::vector<double> ng_counts;
+  for(int i = 0; i < vect_len; ++i) {
+    if(value_ids[i] < 0) {
+      continue;
+    }
+    int t = target[value_ids[i]];
+    if(ng_ids[t] < 0) {
+      ng_ids[t] = ng_values.size();
+      ng_values.push_back(t);
+      ng_counts.push_back(0);
+    }
+    ng_counts[ng_ids[t]] += counts.size() > 0 ? (double)counts[i] : 1.0;
+  }
+  int ng_len = ng_values.size();
+  CharacterVector fp_ng(ng_len);
+  for(int v = 0; v < ng_len; ++v) {
+    int t = ng_values[v];
+    SET_STRING_ELT(fp_ng, v, t < univect_len ? STRING_ELT(fp_ngram, t) :
+                     STRING_ELT(fp_dict_ngram, t - univect_len));
+  }
+
+  // Ngram step, on the values left.
+  refinr_groups ng_clusters;
+  ngram_approx_stats stats;
+  if(ISNAN(edit_threshold)) {
+    std::vector<int> key_ids;
+    prog.stage("fingerprint", ng_len);
+    int n_keys = fingerprint_key_ids(fp_ng, fp, numgram, key_ids, prog);
+    ng_clusters = refinr::build_groups(key_ids, n_keys, 2);
+  } else {
+    ngram_approx_args args = {
+      edit_threshold, R_PosInf, blocking, bands, rows, window,
+      {method, weight, p, bt, q, useBytes, nthread}, R_PosInf
+    };
+    ng_clusters = ngram_approx_clusters(fp_ng, fp, numgram, args, stats,
+                                        prog);
+  }
+
+  std::vector<int> canonical(ng_len);
+  for(int v = 0; v < ng_len; ++v) {
+    canonical[v] = v;
+  }
+  prog.stage("merge", ng_clusters.size());
+  refinr::merge_clusters(
+    ng_clusters, ng_counts,
+    [&](int v) { return kc_value(ng_values[v]); }, canonical, prog
+  );
+
+  // Create the output, each element of vect being replaced by the value its
+  // key collision target was merged into.
+  CharacterVector output(vect_len);
+  prog.stage("output", vect_len);
+  for(int i = 0; i < vect_len; ++i) {
+    if(value_ids[i] < 0) {
+      SET_STRING_ELT(output, i, NA_STRING);
+    } else {
+      int t = ng_values[canonical[ng_ids[target[value_ids[i]]]]];
+      SET_STRING_ELT(output, i, t < univect_len ? STRING_ELT(univect, t) :
+                       STRING_ELT(dict, t - univect_len));
+    }
+    prog.step();
+  }
+
+  return List::create(_["output"] = output,
+                      _["candidate_pairs"] = stats.n_pairs);
+}
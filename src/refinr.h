@@ -1,56 +1,340 @@
 #include <Rcpp.h>
+#include <refinr/core.h>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <unordered_map>
 using namespace Rcpp;
 
 
-// Data structure used by function most_freq_str()
-struct freq_string {
-  String mf_str;
-  IntegerVector x_tab;
-  CharacterVector tab_names;
+// The clustering engine lives in the header-only core library under
+// inst/include/refinr, which has no dependency on R. The files in src/ are
+// thin adapters between R objects and the core.
+
+// View of the bytes of a CHARSXP.
+inline std::string_view char_view(SEXP x) {
+  return std::string_view(CHAR(x), LENGTH(x));
+}
+
+// Hash for pointers to CHARSXP SEXP. CHARSXP pointers are aligned, mix the
+// high bits down into the low bits.
+struct sexp_hash {
+  size_t operator()(SEXP x) const {
+    uint64_t h = (uint64_t)(uintptr_t)x;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+  }
 };
 
-// Define std::unordered_map using SEXP as keys and std::vector<int>
-// as values.
-typedef std::unordered_map<SEXP, std::vector<int> > refinr_map;
+// Before R 3.5.0 there are no ALTREP vectors, every vector can be read
+// through its data pointer.
+#ifdef R_VERSION
+#if R_VERSION < R_Version(3, 5, 0)
+#define ALTREP(x) 0
+#define STRING_PTR_RO(x) ((const SEXP*) STRING_PTR(x))
+#endif
+#endif
 
+// Call f(i, x[i]) for each element of character vector x, in order. Plain
+// vectors are read through their data pointer. ALTREP vectors (e.g. lazily
+// loaded columns from vroom or arrow) would be expanded in memory as a
+// whole by that, so they are read one element at a time with STRING_ELT
+// instead. Their elements may then be created on access, and f must be done
+// with each one, or keep it alive, before the next is read (see
+// refinr_index).
+template <class Fn>
+inline void for_each_string(SEXP x, Fn f) {
+  R_xlen_t n = XLENGTH(x);
+  if(ALTREP(x)) {
+    for(R_xlen_t i = 0; i < n; ++i) {
+      f(i, STRING_ELT(x, i));
+    }
+    return;
+  }
+  const SEXP* ptr = STRING_PTR_RO(x);
+  for(R_xlen_t i = 0; i < n; ++i) {
+    f(i, ptr[i]);
+  }
+}
 
-// utils
-refinr_map create_map(const CharacterVector &vect,
-                      const CharacterVector &clusters);
+// Copy of character vector x along with its attributes, built one element
+// at a time (see for_each_string()). Unlike clone(), this doesn't expand an
+// ALTREP x in memory before copying it.
+inline CharacterVector copy_strings(const CharacterVector &x) {
+  CharacterVector out(x.size());
+  for_each_string(x, [&](R_xlen_t i, SEXP s) { SET_STRING_ELT(out, i, s); });
+  DUPLICATE_ATTRIB(out, x);
+  return out;
+}
+
+// Index mapping pointers to CHARSXP SEXP onto integer group ids. R caches
+// CHARSXPs, so equal strings share a pointer as long as one of them is
+// alive. The elements of an ALTREP vector may be created on access and
+// collected right after, so with keep_alive, the index holds on to the
+// CHARSXP of each group in a character vector of its own. Equal strings read
+// later then get the same pointer, at the cost of one slot per group rather
+// than a copy of the vector. The kept CHARSXPs live as long as the index.
+class refinr_index {
+public:
+  explicit refinr_index(size_t n_keys, bool keep_alive = false) :
+    index(n_keys), keep_alive(keep_alive) {}
+
+  // Return the id of x, inserting it with the next free id if it is new.
+  int insert(SEXP x) {
+    int id = index.insert(x);
+    if(keep_alive && id == n_kept) {
+      keep(x);
+    }
+    return id;
+  }
+
+  // Return the id of x, or -1 if x is not in the index.
+  int find(SEXP x) const { return index.find(x); }
 
-refinr_map create_map_no_na(CharacterVector &terms,
-                            const CharacterVector &keys);
+  // Number of distinct CHARSXPs inserted.
+  int size() const { return index.size(); }
 
-bool cpp_all(const CharacterVector &x, const CharacterVector &table);
-List cpp_list_unique(List &input, const bool &sort_vals);
-CharacterVector cpp_paste_list(List &input, const std::string &collapse_str);
-CharacterVector cpp_get_key_dups(CharacterVector keys);
-List cpp_flatten_list(List &list_obj);
-void most_freq_str(const CharacterVector &x, freq_string &mfs);
-List cpp_as_list(const CharacterVector &x);
-CharacterVector cpp_unlist(const List &x);
+private:
+  refinr::key_index<SEXP, sexp_hash> index;
+  bool keep_alive;
+  CharacterVector kept;
+  int n_kept = 0;
+
+  void keep(SEXP x) {
+    if(n_kept == kept.size()) {
+      PROTECT(x);
+      CharacterVector bigger(std::max(2 * n_kept, 1024));
+      for(int i = 0; i < n_kept; ++i) {
+        SET_STRING_ELT(bigger, i, STRING_ELT(kept, i));
+      }
+      kept = bigger;
+      UNPROTECT(1);
+    }
+    SET_STRING_ELT(kept, n_kept++, x);
+  }
+};
+
+// Grouping index in compressed sparse row form, see refinr/groups.h.
+typedef refinr::groups refinr_groups;
+
+// Progress adapter for the R functions, see progress.cpp. Checks for user
+// interrupts, and passes progress along to an R callback (R_NilValue for
+// none).
+class r_progress : public refinr::progress {
+public:
+  explicit r_progress(SEXP callback);
+
+protected:
+  void update(const char* name, double done, double total);
+
+private:
+  SEXP callback;
+  std::string curr_stage;
+  std::chrono::steady_clock::time_point stage_start;
+  std::chrono::steady_clock::time_point last_update;
+  double last_done = 0;
+};
+
+
+// utils
+refinr_groups create_groups(const CharacterVector &terms,
+                            const CharacterVector &keys,
+                            refinr::progress &prog);
+
+int assign_group_ids(const CharacterVector &keys,
+                     refinr_index &index,
+                     std::vector<int> &ids,
+                     refinr::progress &prog);
 
 
 // key_collision_merge
-CharacterVector merge_KC_clusters_no_dict(const CharacterVector &clusters,
-                                          const CharacterVector &vect,
-                                          CharacterVector &keys_vect);
+int KC_key_ids(const CharacterVector &vect,
+               const CharacterVector &fp_univect,
+               const CharacterVector &fp_dict,
+               const refinr::fingerprinter &fp,
+               refinr_index &value_index,
+               std::vector<int> &ids,
+               refinr::progress &prog);
+
+int KC_value_key_ids(const CharacterVector &vect,
+                     const CharacterVector &fp_univect,
+                     const CharacterVector &fp_dict,
+                     const refinr::fingerprinter &fp,
+                     refinr_index &value_index,
+                     std::vector<int> &value_ids,
+                     std::vector<int> &first,
+                     std::vector<int> &key_ids,
+                     refinr::progress &prog);
 
-CharacterVector merge_KC_clusters_dict(const CharacterVector &clusters,
-                                       const CharacterVector &vect,
-                                       CharacterVector &keys_vect,
+CharacterVector merge_KC_clusters_no_dict(const CharacterVector &vect,
+                                          const refinr_groups &clusters,
+                                          const NumericVector &counts,
+                                          refinr::progress &prog);
+
+CharacterVector merge_KC_clusters_dict(const CharacterVector &vect,
                                        const CharacterVector &dict,
-                                       const CharacterVector &keys_dict);
+                                       const refinr_groups &clusters,
+                                       const NumericVector &counts,
+                                       refinr::progress &prog);
+
+
+// Args passed along to the stringdist C API functions.
+struct stringdist_args {
+  SEXP method;
+  SEXP weight;
+  SEXP p;
+  SEXP bt;
+  SEXP q;
+  SEXP useBytes;
+  SEXP nthread;
+};
+
+// Edit distances between the keys of one initial ngram cluster, see
+// n_gram_merge.cpp.
+class cluster_distances {
+public:
+  cluster_distances(const CharacterVector &clust,
+                    const bool &streamed,
+                    const stringdist_args &sd_args);
+  void row(const int &r, std::vector<double> &out);
+
+private:
+  CharacterVector clust;
+  bool streamed;
+  stringdist_args sd_args;
+  int n;
+  NumericVector lower_tri;
+  CharacterVector a;
+};
 
 
 // n_gram_merge
-List get_ngram_initial_clusters(CharacterVector ngram_keys,
-                                CharacterVector unigram_keys);
+CharacterVector merge_ngram_clusters(const refinr_groups &clusters,
+                                     const CharacterVector &univect,
+                                     const CharacterVector &vect,
+                                     const NumericVector &counts,
+                                     std::vector<double> &univect_counts,
+                                     refinr::progress &prog);
+
+std::vector<double> value_counts(const refinr_groups &univect_groups,
+                                 const NumericVector &counts);
+
+// Args of approximate ngram matching, see ngram_merge_approx().
+struct ngram_approx_args {
+  double edit_threshold;
+  double dist_budget;
+  std::string blocking;
+  int bands;
+  int rows;
+  int window;
+  stringdist_args sd_args;
+  double time_budget;
+};
+
+// Counts reported by approximate ngram matching, see ngram_approx_clusters().
+struct ngram_approx_stats {
+  int n_dense = 0;
+  int n_streamed = 0;
+  double peak_bytes = 0;
+  double n_pairs = 0;
+  int n_blocks = 0;
+  int n_blocks_done = 0;
+  double n_pairs_done = 0;
+};
+
+refinr_groups ngram_approx_clusters(const CharacterVector &fp_univect,
+                                    const refinr::fingerprinter &fp,
+                                    const int &numgram,
+                                    const ngram_approx_args &args,
+                                    ngram_approx_stats &stats,
+                                    refinr::progress &prog);
+
+// Initial ngram clusters (blocks) filtered by a run, and the clusters each
+// was filtered into, for delta runs against a saved state (see state.cpp).
+// A block is identified by a 128 bit hash of the ngram keys of its
+// elements, in order, which is all that its filtering depends on given the
+// args of the run. Its clusters are recorded as positions within the block,
+// as key ids differ between runs. A default constructed cache finds and
+// records nothing.
+class block_cache {
+public:
+  block_cache() : active(false) {}
+  explicit block_cache(SEXP prev);
+
+  // Look up the block holding keys, the key ids of its elements being ids.
+  // If found, append its clusters of key ids to out and return true.
+  bool find(const CharacterVector &keys, const std::vector<int> &ids,
+            std::vector<std::vector<int> > &out);
+
+  // Record the block last passed to find(), along with the clusters it was
+  // filtered into, clusters[first] onwards.
+  void record(const std::vector<int> &ids,
+              const std::vector<std::vector<int> > &clusters,
+              const size_t &first);
+
+  // The recorded blocks, as a list that a cache can be built from.
+  List blocks() const;
+
+private:
+  bool active;
+  std::string curr;
+  std::unordered_map<std::string, int> prev_index;
+  std::vector<int> prev_first;
+  std::vector<int> prev_offsets;
+  std::vector<int> prev_members;
+  std::vector<std::string> signatures;
+  std::vector<int> n_clusters;
+  std::vector<int> sizes;
+  std::vector<int> positions;
+};
+
+refinr_groups filter_ngram_blocks(const refinr_groups &initial_clust,
+                                  const std::vector<int> &key_ids,
+                                  const refinr_groups &key_groups,
+                                  const std::function<SEXP(int)> &key_char,
+                                  const ngram_approx_args &args,
+                                  ngram_approx_stats &stats,
+                                  block_cache &cache,
+                                  refinr::progress &prog);
+
+NumericVector distance_plan(const ngram_approx_stats &stats);
+
+NumericVector distance_coverage(const ngram_approx_stats &stats);
+
+refinr_groups get_ngram_initial_clusters(const refinr::string_arena &norms,
+                                         const std::vector<int> &key_ids,
+                                         const refinr_groups &key_groups,
+                                         const std::vector<int> &unigram_ids,
+                                         const int &n_unigram_keys,
+                                         const int &numgram,
+                                         const ngram_approx_args &args,
+                                         double &n_pairs,
+                                         refinr::progress &prog);
+
+double dense_distance_bytes(const int &k);
+double streamed_distance_bytes(const int &k);
+
+
+// fingerprint
+refinr::fingerprinter make_fingerprinter(const bool &bus_suffix,
+                                         const CharacterVector &ignore_strings);
+
+bool fingerprint_key(const refinr::fingerprinter &fp,
+                     const int &numgram,
+                     SEXP x,
+                     std::string &out);
+
+int fingerprint_key_ids(const CharacterVector &vect,
+                        const refinr::fingerprinter &fp,
+                        const int &numgram,
+                        std::vector<int> &ids,
+                        refinr::progress &prog);
 
-List filter_initial_clusters(const List &distmatrices,
-                             const double &edit_threshold,
-                             const List &clusters);
 
+// stringdist
 SEXP stringdist_lower_tri(const SEXP &a,
                           const SEXP &method,
                           const SEXP &weight,
@@ -60,11 +344,12 @@ SEXP stringdist_lower_tri(const SEXP &a,
                           const SEXP &useBytes,
                           const SEXP &nthread);
 
-List get_stringdist_matrices(const List &clusters,
-                             const SEXP &method,
-                             const SEXP &weight,
-                             const SEXP &p,
-                             const SEXP &bt,
-                             const SEXP &q,
-                             const SEXP &useBytes,
-                             const SEXP &nthread);
+SEXP stringdist_elementwise(const SEXP &a,
+                            const SEXP &b,
+                            const SEXP &method,
+                            const SEXP &weight,
+                            const SEXP &p,
+                            const SEXP &bt,
+                            const SEXP &q,
+                            const SEXP &useBytes,
+                            const SEXP &nthread);
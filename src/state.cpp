@@ -0,0 +1,338 @@
+#include <Rcpp.h>
+#include"refinr.h"
+using namespace Rcpp;
+
+
+// Adapters for merges run against the saved state of an earlier run, see
+// state.R. The keys of the unique values are passed in as strings, those of
+// the values seen by the earlier run being read from its state, rather than
+// computed from the values. They are given ids and clustered exactly as the
+// keys of a full run, so that the output is the same.
+
+
+// Get the id of each key of keys, numbered as in refinr::hashed_key_ids(),
+// so that the ids are those a full run computing the keys would give them.
+// NA keys get id -1. Returns the number of distinct keys.
+static int key_string_ids(const CharacterVector &keys, std::vector<int> &ids) {
+  return refinr::hashed_key_ids(
+    keys.size(),
+    [&](int i, std::string &out) {
+      SEXP x = STRING_ELT(keys, i);
+      if(x == NA_STRING) {
+        return false;
+      }
+      out.assign(CHAR(x), LENGTH(x));
+      return true;
+    },
+    ids
+  );
+}
+
+
+// Get the ngram key of each element of fp_vect, and if unigram is TRUE its
+// unigram key, normalizing each element once. fp_vect holds values with the
+// R steps of the ngram fingerprint method applied. Elements without a key
+// get an NA key. As in a full run, an NA element is keyed as the string "NA"
+// when unigram keys are used (see ngram_approx_clusters()), and has no key
+// otherwise (see fingerprint_key_ids()). progress is an R callback for
+// progress reports, or NULL (see progress.cpp).
+// Returns a list holding the ngram keys, and the unigram keys if unigram is
+// TRUE.
+// [[Rcpp::export]]
+List ngram_state_keys(const CharacterVector &fp_vect,
+                      const int &numgram,
+                      const bool &unigram,
+                      const bool &bus_suffix,
+                      const CharacterVector &ignore_strings,
+                      const SEXP &progress) {
+  refinr::fingerprinter fp = make_fingerprinter(bus_suffix, ignore_strings);
+  r_progress prog(progress);
+  int vect_len = fp_vect.size();
+  std::vector<int> numgrams = {numgram};
+  if(unigram) {
+    numgrams.push_back(1);
+  }
+
+  CharacterVector out_keys(vect_len);
+  CharacterVector out_unigrams(unigram ? vect_len : 0);
+  auto mk_key = [](const std::string &key) {
+    return key.empty() ? NA_STRING :
+      Rf_mkCharLenCE(key.data(), key.size(), CE_UTF8);
+  };
+  std::vector<std::string> keys;
+  SEXP x;
+  prog.stage("fingerprint", vect_len);
+  for(int i = 0; i < vect_len; ++i) {
+    x = STRING_ELT(fp_vect, i);
+    keys.assign(numgrams.size(), std::string());
+    if(unigram || x != NA_STRING) {
+      fp.ngram_keys(char_view(x), numgrams, keys);
+    }
+    SET_STRING_ELT(out_keys, i, mk_key(keys[0]));
+    if(unigram) {
+      SET_STRING_ELT(out_unigrams, i, mk_key(keys[1]));
+    }
+    prog.step();
+  }
+
+  if(unigram) {
+    return List::create(_["key"] = out_keys, _["unigram"] = out_unigrams);
+  }
+  return List::create(_["key"] = out_keys);
+}
+
+
+// Key collision merge of vect given the keys of its unique values. univect
+// holds the unique values of vect, and keys the key collision key of each
+// (NA for none). dict and dict_keys hold the values of the data dict and
+// their keys, or NA if there is no dict. counts holds the number of times
+// each element of vect was counted, or is empty if each element counts once.
+// progress is an R callback for progress reports, or NULL (see
+// progress.cpp).
+// Values are grouped by key string rather than by key hash, which gives the
+// same clusters as merge_KC_clusters(), in another order. Key collision
+// clusters never overlap, so the order doesn't change the output.
+// Returns a list holding the output vector, and the count of each univect
+// value.
+// [[Rcpp::export]]
+List merge_KC_keyed(const CharacterVector &vect,
+                    const CharacterVector &univect,
+                    const CharacterVector &keys,
+                    const CharacterVector &dict,
+                    const CharacterVector &dict_keys,
+                    const NumericVector &counts,
+                    const SEXP &progress) {
+  r_progress prog(progress);
+  bool has_dict = !CharacterVector::is_na(dict[0]);
+  int vect_len = vect.size();
+  int univect_len = univect.size();
+
+  // Get the key id of each univect value, and of each value of dict.
+  refinr_index key_index(univect_len);
+  std::vector<int> value_keys;
+  value_keys.reserve(univect_len);
+  assign_group_ids(keys, key_index, value_keys, refinr::no_progress());
+  std::vector<int> dict_ids;
+  int n_keys = key_index.size();
+  if(has_dict) {
+    n_keys = assign_group_ids(dict_keys, key_index, dict_ids,
+                              refinr::no_progress());
+  }
+
+  // Get the key id of each element of vect, followed by the values of dict,
+  // and the count of each univect value.
+  refinr_index value_index(univect_len);
+  for_each_string(univect, [&](R_xlen_t i, SEXP x) { value_index.insert(x); });
+  std::vector<int> ids(vect_len);
+  NumericVector value_counts(univect_len);
+  bool weighted = counts.size() > 0;
+  prog.stage("index", vect_len);
+  for_each_string(vect, [&](R_xlen_t i, SEXP x) {
+    int u = x == NA_STRING ? -1 : value_index.find(x);
+    ids[i] = u < 0 ? -1 : value_keys[u];
+    if(u >= 0) {
+      value_counts[u] += weighted ? (double)counts[i] : 1.0;
+    }
+    prog.step();
+  });
+  ids.insert(ids.end(), dict_ids.begin(), dict_ids.end());
+  refinr_groups clusters = refinr::build_groups(ids, n_keys, 2);
+
+  prog.stage("merge", clusters.size());
+  CharacterVector output = has_dict ?
+    merge_KC_clusters_dict(vect, dict, clusters, counts, prog) :
+    merge_KC_clusters_no_dict(vect, clusters, counts, prog);
+
+  return List::create(_["output"] = output, _["counts"] = value_counts);
+}
+
+
+// Ngram merge of vect without approximate string matching, given the ngram
+// keys of its unique values, see ngram_merge_no_approx(). univect holds the
+// unique values of vect, and keys the ngram key of each (NA for none).
+// counts holds the number of times each element of vect was counted, or is
+// empty if each element counts once. progress is an R callback for progress
+// reports, or NULL (see progress.cpp).
+// Returns a list holding the output vector, and the count of each univect
+// value.
+// [[Rcpp::export]]
+List ngram_merge_no_approx_keyed(const CharacterVector &univect,
+                                 const CharacterVector &vect,
+                                 const CharacterVector &keys,
+                                 const NumericVector &counts,
+                                 const SEXP &progress) {
+  r_progress prog(progress);
+  std::vector<int> key_ids;
+  int n_keys = key_string_ids(keys, key_ids);
+  refinr_groups clusters = refinr::build_groups(key_ids, n_keys, 2);
+
+  std::vector<double> univect_counts;
+  CharacterVector output = merge_ngram_clusters(clusters, univect, vect,
+                                                counts, univect_counts, prog);
+  return List::create(_["output"] = output,
+                      _["counts"] = wrap(univect_counts));
+}
+
+
+// Ngram merge of vect with approximate string matching and unigram
+// blocking, given the ngram and unigram keys of its unique values, see
+// ngram_merge_approx(). univect holds the unique values of vect, keys the
+// ngram key of each, and unigrams its unigram key (NA for none). blocks
+// holds the initial clusters filtered by the earlier run, and the clusters
+// each was filtered into (see block_cache), or NULL. Only the initial
+// clusters that are not in blocks have their edit distances computed.
+// counts holds the number of times each element of vect was counted, or is
+// empty if each element counts once. progress is an R callback for progress
+// reports, or NULL (see progress.cpp).
+// Returns a list holding the output vector, the distance plan and the number
+// of candidate pairs (as ngram_merge_approx() does), the count of each
+// univect value, and the initial clusters of this run along with the
+// clusters each was filtered into.
+// [[Rcpp::export]]
+List ngram_merge_approx_keyed(const CharacterVector &univect,
+                              const CharacterVector &vect,
+                              const CharacterVector &keys,
+                              const CharacterVector &unigrams,
+                              const double &edit_threshold,
+                              const double &dist_budget,
+                              const SEXP &method,
+                              const SEXP &weight,
+                              const SEXP &p,
+                              const SEXP &bt,
+                              const SEXP &q,
+                              const SEXP &useBytes,
+                              const SEXP &nthread,
+                              const SEXP &blocks,
+                              const NumericVector &counts,
+                              const SEXP &progress) {
+  ngram_approx_args args = {
+    edit_threshold, dist_budget, "unigram", 0, 0, 0,
+    {method, weight, p, bt, q, useBytes, nthread}, R_PosInf
+  };
+  r_progress prog(progress);
+  int univect_len = univect.size();
+
+  // Give each key an id, group the univect indices by ngram key, and block
+  // them by unigram key, as ngram_approx_clusters() does.
+  prog.stage("block", univect_len);
+  std::vector<int> key_ids;
+  std::vector<int> unigram_ids;
+  int n_keys = key_string_ids(keys, key_ids);
+  int n_unigram_keys = key_string_ids(unigrams, unigram_ids);
+  refinr_groups key_groups = refinr::build_groups(key_ids, n_keys, 1);
+  refinr_groups initial_clust = refinr::unigram_blocks(key_ids, unigram_ids,
+                                                       n_unigram_keys);
+  prog.step(univect_len);
+
+  ngram_approx_stats stats;
+  stats.n_pairs = refinr::block_pairs(initial_clust);
+  block_cache cache(blocks);
+  refinr_groups clusters = filter_ngram_blocks(
+    initial_clust, key_ids, key_groups,
+    [&](int u) { return STRING_ELT(keys, u); },
+    args, stats, cache, prog
+  );
+
+  std::vector<double> univect_counts;
+  CharacterVector output = merge_ngram_clusters(clusters, univect, vect,
+                                                counts, univect_counts, prog);
+  return List::create(_["output"] = output,
+                      _["distance_plan"] = distance_plan(stats),
+                      _["candidate_pairs"] = stats.n_pairs,
+                      _["counts"] = wrap(univect_counts),
+                      _["blocks"] = cache.blocks());
+}
+
+
+// Build a cache from the blocks recorded by an earlier run (see
+// block_cache::blocks()), or an empty one if prev is NULL. Either way, the
+// cache records the blocks of this run.
+block_cache::block_cache(SEXP prev) : active(true) {
+  prev_first.push_back(0);
+  prev_offsets.push_back(0);
+  if(Rf_isNull(prev)) {
+    return;
+  }
+  List x(prev);
+  CharacterVector prev_signatures = x["signature"];
+  IntegerVector prev_n_clusters = x["n_clusters"];
+  IntegerVector prev_sizes = x["sizes"];
+  IntegerVector positions = x["positions"];
+  for(int b = 0; b < prev_signatures.size(); ++b) {
+    prev_index.emplace(std::string(CHAR(STRING_ELT(prev_signatures, b))), b);
+    prev_first.push_back(prev_first.back() + prev_n_clusters[b]);
+  }
+  for(int c = 0; c < prev_sizes.size(); ++c) {
+    prev_offsets.push_back(prev_offsets.back() + prev_sizes[c]);
+  }
+  prev_members.assign(positions.begin(), positions.end());
+}
+
+
+bool block_cache::find(const CharacterVector &keys,
+                       const std::vector<int> &ids,
+                       std::vector<std::vector<int> > &out) {
+  if(!active) {
+    return false;
+  }
+
+  // Hash the keys, each prefixed by its length, twice under different seeds.
+  std::string buf;
+  for(int n = 0; n < keys.size(); ++n) {
+    std::string_view key = char_view(STRING_ELT(keys, n));
+    uint32_t len = key.size();
+    buf.append((const char*)&len, sizeof(len));
+    buf.append(key.data(), key.size());
+  }
+  char hex[33];
+  snprintf(hex, sizeof(hex), "%016llx%016llx",
+           (unsigned long long)refinr::hash_bytes(buf),
+           (unsigned long long)refinr::hash_bytes(buf, 0x9e3779b97f4a7c15ULL));
+  curr.assign(hex, 32);
+
+  std::unordered_map<std::string, int>::const_iterator it =
+    prev_index.find(curr);
+  if(it == prev_index.end()) {
+    return false;
+  }
+  for(int c = prev_first[it->second]; c < prev_first[it->second + 1]; ++c) {
+    std::vector<int> clust;
+    for(int m = prev_offsets[c]; m < prev_offsets[c + 1]; ++m) {
+      clust.push_back(ids[prev_members[m]]);
+    }
+    out.push_back(clust);
+  }
+  return true;
+}
+
+
+void block_cache::record(const std::vector<int> &ids,
+                         const std::vector<std::vector<int> > &clusters,
+                         const size_t &first) {
+  if(!active) {
+    return;
+  }
+  signatures.push_back(curr);
+  n_clusters.push_back(clusters.size() - first);
+
+  // Record each key id by the position of its first element in the block.
+  for(size_t c = first; c < clusters.size(); ++c) {
+    sizes.push_back(clusters[c].size());
+    for(int id : clusters[c]) {
+      int pos = std::find(ids.begin(), ids.end(), id) - ids.begin();
+      positions.push_back(pos);
+    }
+  }
+}
+
+
+List block_cache::blocks() const {
+  CharacterVector out_signatures(signatures.size());
+  for(size_t b = 0; b < signatures.size(); ++b) {
+    SET_STRING_ELT(out_signatures, b, Rf_mkChar(signatures[b].c_str()));
+  }
+  return List::create(_["signature"] = out_signatures,
+                      _["n_clusters"] = wrap(n_clusters),
+                      _["sizes"] = wrap(sizes),
+                      _["positions"] = wrap(positions));
+}
@@ -19,3 +19,19 @@ SEXP stringdist_lower_tri(const SEXP &a,
                           const SEXP &nthread) {
   return(sd_lower_tri(a, method, weight, p, bt, q, useBytes, nthread));
 }
+
+
+// Function that wraps the stringdist C function "sd_stringdist()". Elements
+// of a and b are recycled, so passing a single string as a gives the
+// distances between that string and every element of b.
+SEXP stringdist_elementwise(const SEXP &a,
+                            const SEXP &b,
+                            const SEXP &method,
+                            const SEXP &weight,
+                            const SEXP &p,
+                            const SEXP &bt,
+                            const SEXP &q,
+                            const SEXP &useBytes,
+                            const SEXP &nthread) {
+  return(sd_stringdist(a, b, method, weight, p, bt, q, useBytes, nthread));
+}